@@ -0,0 +1,90 @@
+// adaptive_interval.cpp file - Telemetry interval adapted to link quality, battery and data volatility
+#include <math.h>
+
+#include "adaptive_interval.h"
+#include "azure_helper.h"
+
+AdaptiveInterval adaptiveInterval;
+
+// Interval factors in percent, by tier: good, fair, poor
+static const uint16_t tierFactor[] = {100, 200, 400};
+#define VOLATILE_FACTOR 50
+
+static Gauge adaptiveIntervalMs("adaptive.interval_ms");
+static Gauge adaptiveRssi("adaptive.rssi_avg_dbm");
+static Gauge adaptiveRssiFactor("adaptive.rssi_factor_pct");
+static Gauge adaptiveBatteryFactor("adaptive.battery_factor_pct");
+static Gauge adaptiveVolatilityFactor("adaptive.volatility_factor_pct");
+static Counter adaptiveChanges("adaptive.changes");
+
+// Lower is worse for both RSSI and battery. A worse tier applies at once;
+// a better one only once the value is past its boundary by the hysteresis.
+static uint8_t nextTier(float value, uint8_t tier, float fair, float poor, float hysteresis) {
+    uint8_t worse = value < poor ? 2 : value < fair ? 1 : 0;
+    uint8_t better = value < poor + hysteresis ? 2 : value < fair + hysteresis ? 1 : 0;
+    if (worse > tier) return worse;
+    if (better < tier) return better;
+    return tier;
+}
+
+AdaptiveInterval::AdaptiveInterval()
+    : baseMs(TELEMETRY_INTERVAL), intervalMs(TELEMETRY_INTERVAL), rssiAvg(NAN), rssiTier(0), batteryTier(0),
+      volatileData(false), calmWindows(0), lastTemperature(NAN), lastHumidity(NAN) {}
+
+void AdaptiveInterval::setBaseInterval(uint32_t interval) {
+    baseMs = interval;
+    recompute();
+}
+
+uint32_t AdaptiveInterval::update(int32_t rssi, uint8_t batteryLevel, float temperatureAvg, float humidityAvg) {
+    // RSSI is 0 while disconnected; keep the last estimate then
+    if (rssi < 0) {
+        rssiAvg = isnan(rssiAvg) ? rssi : rssiAvg + ADAPTIVE_RSSI_SMOOTHING * (rssi - rssiAvg);
+        rssiTier = nextTier(rssiAvg, rssiTier, ADAPTIVE_RSSI_FAIR, ADAPTIVE_RSSI_POOR, ADAPTIVE_RSSI_HYSTERESIS);
+        adaptiveRssi.set((int32_t)lroundf(rssiAvg));
+    }
+    batteryTier = nextTier(batteryLevel, batteryTier, ADAPTIVE_BATTERY_LOW, ADAPTIVE_BATTERY_CRITICAL,
+                           ADAPTIVE_BATTERY_HYSTERESIS);
+
+    bool moved = !isnan(lastTemperature) &&
+                 (fabsf(temperatureAvg - lastTemperature) >= ADAPTIVE_VOLATILE_TEMPERATURE ||
+                  fabsf(humidityAvg - lastHumidity) >= ADAPTIVE_VOLATILE_HUMIDITY);
+    lastTemperature = temperatureAvg;
+    lastHumidity = humidityAvg;
+    if (moved) {
+        volatileData = true;
+        calmWindows = 0;
+    } else if (volatileData && ++calmWindows >= ADAPTIVE_CALM_WINDOWS) {
+        volatileData = false;
+    }
+
+    recompute();
+    return intervalMs;
+}
+
+void AdaptiveInterval::recompute() {
+    uint32_t rssiFactor = tierFactor[rssiTier];
+    uint32_t batteryFactor = tierFactor[batteryTier];
+    uint32_t volatilityFactor = volatileData ? VOLATILE_FACTOR : 100;
+    adaptiveRssiFactor.set(rssiFactor);
+    adaptiveBatteryFactor.set(batteryFactor);
+    adaptiveVolatilityFactor.set(volatilityFactor);
+
+    uint64_t scaled = (uint64_t)baseMs * rssiFactor * batteryFactor * volatilityFactor / 1000000;
+    uint32_t next = constrain(scaled, (uint64_t)TELEMETRY_INTERVAL_MIN, (uint64_t)TELEMETRY_INTERVAL_MAX);
+    if (next != intervalMs) {
+        LOG_INFO("Telemetry interval %lu -> %lu ms (rssi x%lu%%, battery x%lu%%, volatility x%lu%%)",
+                 (unsigned long)intervalMs, (unsigned long)next, (unsigned long)rssiFactor,
+                 (unsigned long)batteryFactor, (unsigned long)volatilityFactor);
+        intervalMs = next;
+        adaptiveChanges.inc();
+    }
+    adaptiveIntervalMs.set(intervalMs);
+}
+
+void AdaptiveInterval::printStatus() {
+    Serial.printf("Telemetry interval: %lu ms (base %lu ms, rssi avg %.0f dBm x%u%%, battery x%u%%, %s), %lu changes\n",
+                  (unsigned long)intervalMs, (unsigned long)baseMs, isnan(rssiAvg) ? 0.0f : rssiAvg,
+                  tierFactor[rssiTier], tierFactor[batteryTier], volatileData ? "volatile x50%" : "calm",
+                  (unsigned long)adaptiveChanges.get());
+}
@@ -0,0 +1,55 @@
+// adaptive_interval.h file - Telemetry interval adapted to link quality, battery and data volatility
+#pragma once
+
+#include <Arduino.h>
+
+#define ADAPTIVE_RSSI_FAIR -70           // dBm; below this the interval doubles
+#define ADAPTIVE_RSSI_POOR -80           // and below this it quadruples
+#define ADAPTIVE_RSSI_HYSTERESIS 3       // dB past a boundary before the tier improves again
+#define ADAPTIVE_RSSI_SMOOTHING 0.25f    // EWMA weight of each new RSSI reading
+#define ADAPTIVE_BATTERY_LOW 40          // percent; below this the interval doubles
+#define ADAPTIVE_BATTERY_CRITICAL 20     // and below this it quadruples
+#define ADAPTIVE_BATTERY_HYSTERESIS 5
+#define ADAPTIVE_VOLATILE_TEMPERATURE 1.0f  // window average change that counts as volatile
+#define ADAPTIVE_VOLATILE_HUMIDITY 3.0f
+#define ADAPTIVE_CALM_WINDOWS 3          // calm windows before a tightened interval relaxes
+
+// Scales the telemetry interval set through the twin (the base) by three
+// factors, recomputed once per routine window:
+// - link quality: on a weak link every send risks retransmits and a failed
+//   TLS handshake, so fewer, larger batches cost less energy per reading
+// - battery: a low battery stretches the interval to last longer
+// - volatility: when the window averages move, the interval is halved so
+//   the changes are not lost in one long average
+// RSSI and battery move between tiers with hysteresis so the interval does
+// not flap around a boundary. The result is clamped to the twin's bounds.
+// Network task only.
+class AdaptiveInterval {
+public:
+    AdaptiveInterval();
+
+    void setBaseInterval(uint32_t intervalMs);
+    uint32_t getBaseInterval() const { return baseMs; }
+
+    // Once per routine window, before it is sent or suppressed. Returns the
+    // interval to use from now on.
+    uint32_t update(int32_t rssi, uint8_t batteryLevel, float temperatureAvg, float humidityAvg);
+
+    uint32_t getInterval() const { return intervalMs; }
+    void printStatus();
+
+private:
+    uint32_t baseMs;
+    uint32_t intervalMs;
+    float rssiAvg;
+    uint8_t rssiTier;
+    uint8_t batteryTier;
+    bool volatileData;
+    uint8_t calmWindows;
+    float lastTemperature;
+    float lastHumidity;
+
+    void recompute();
+};
+
+extern AdaptiveInterval adaptiveInterval;
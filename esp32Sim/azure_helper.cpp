@@ -1,8 +1,11 @@
 // azure_helper.cpp file - Enhanced implementation
 #include <HTTPClient.h>
+#include <WiFi.h>
 #include <WiFiClientSecure.h>
 #include <cstdlib> 
 #include <string.h>
+#include <math.h>
+#include <esp_timer.h>
 
 #include "azure_helper.h"
 
@@ -16,12 +19,46 @@ String sasToken = "";
 // Global IoT Hub client instance
 AzureIoTHubClient iotHubClient;
 
+// Backoff and circuit breakers for the two endpoints
+RetryPolicy hubRetry("hub", TELEMETRY_RETRY_INTERVAL, RETRY_MAX_DELAY, CIRCUIT_FAILURE_THRESHOLD, CIRCUIT_OPEN_INTERVAL);
+RetryPolicy dpsRetry("dps", DPS_RETRY_INTERVAL, RETRY_MAX_DELAY, CIRCUIT_FAILURE_THRESHOLD, CIRCUIT_OPEN_INTERVAL);
+
+TokenBucket hubLimiter("hub", HUB_MESSAGES_PER_SECOND, HUB_MESSAGE_BURST);
+
+TelemetryDeadbands telemetryDeadbands = {0.0f, 0.0f};
+
+static Counter telemetrySuppressed("telemetry.suppressed");
+static float lastSentTemperature = NAN;
+static float lastSentHumidity = NAN;
+
+// Per-lane latency: first sample in the message to the hub accepting it
+static Histogram routineLatencyMs("telemetry.latency_ms");
+static Histogram alertLatencyMs("alerts.latency_ms");
+static Counter alertsSent("alerts.sent");
+static Counter alertsDropped("alerts.dropped");
+
+// Firmware status messages waiting for the OTA task
+struct FirmwareStatusMessage {
+    const char* status;            // string literal from OtaUpdater
+    char targetVersion[32];
+    char error[64];
+};
+static FirmwareStatusMessage firmwareStatusQueue[FIRMWARE_STATUS_QUEUE];
+static uint8_t firmwareStatusCount = 0;
+
+// Alert popped off the sensing queue but not yet accepted by the hub
+static AlertRecord heldAlert;
+static bool holdingAlert = false;
+
 // Provisioning context
 static char dpsAssignedHub[128] = "";
 static char dpsAssignedDeviceId[64] = "";
+static unsigned long provisioningStartTime = 0;
+static int dpsPollCount = 0;
+static bool initialTelemetryDue = false;  // set on assignment, sent after the DPS scope
 
 bool initTime(const char* timezone) {
-    Serial.println("Synchronizing time with NTP server...");
+    LOG_INFO("Synchronizing time with NTP server...");
     
     configTime(0, 0, "pool.ntp.org", "time.nist.gov", "time.google.com");
     
@@ -32,261 +69,454 @@ bool initTime(const char* timezone) {
     while (now < 24 * 3600 && timeout < 150) {
         delay(100);
         now = time(nullptr);
-        if (timeout % 10 == 0) Serial.print(".");
         timeout++;
     }
     
     if (now < 24 * 3600) {
-        Serial.println("\nERROR: Time synchronization failed!");
+        LOG_ERROR("Time synchronization failed!");
         return false;
     }
     
-    Serial.println("\nTime synchronized successfully!");
     struct tm timeinfo;
     localtime_r(&now, &timeinfo);
-    Serial.printf("Current time: %04d-%02d-%02d %02d:%02d:%02d UTC\n",
-                  timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
-                  timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+    LOG_INFO("Time synchronized: %04d-%02d-%02d %02d:%02d:%02d UTC",
+             timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+             timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
     return true;
 }
 
+// Authenticates a DPS request with the device certificate or the SAS token
+static void applyDpsAuth(HttpsRequest& request) {
+#if AZURE_AUTH_X509
+    request.setClientCertificate(deviceCredentials.getCertificate(), deviceCredentials.getPrivateKey());
+#else
+    request.addHeader("Authorization", sasToken.c_str());
+#endif
+}
+
 void startAzureProvisioning() {
+    // Registration and polling share one backoff; wait out any pause
+    if (!dpsRetry.allowRequest()) {
+        return;
+    }
+    
+#if AZURE_AUTH_X509
+    if (!deviceCredentials.isLoaded() && !deviceCredentials.load()) {
+        dpsRetry.recordFailure();
+        return;
+    }
+    
+    // Nothing is signed with the clock, so it only matters for telemetry
+    // timestamps and can sync in the background
+    if (time(nullptr) < 24 * 3600) {
+        configTime(0, 0, "pool.ntp.org", "time.nist.gov", "time.google.com");
+    }
+    
+    HEAP_SCOPE(HEAP_DPS);
+    provisioningStartTime = millis();
+#else
     if (!initTime()) {
-        Serial.println("Cannot proceed without time synchronization");
+        LOG_ERROR("Cannot proceed without time synchronization");
+        dpsRetry.recordFailure();
         return;
     }
     
+    HEAP_SCOPE(HEAP_DPS);
     delay(1000);
     uint32_t expiry = time(NULL) + 3600;
-    Serial.printf("Current time: %u, Token expiry: %u\n", (uint32_t)time(NULL), expiry);
+    LOG_DEBUG("Current time: %u, Token expiry: %u", (uint32_t)time(NULL), expiry);
 
     // If using enrollment groups, derive the individual device key
     String deviceKey = AZURE_SYMMETRIC_KEY;
     
-    Serial.println("Deriving device key from enrollment group key...");
+    LOG_INFO("Deriving device key from enrollment group key...");
     deviceKey = deriveDeviceKey(AZURE_SYMMETRIC_KEY, AZURE_DEVICE_ID);
     
     if (deviceKey.length() == 0) {
-        Serial.println("Failed to derive device key");
+        LOG_ERROR("Failed to derive device key");
+        dpsRetry.recordFailure();
         return;
     }
     
+    provisioningStartTime = millis();
+    
     // Generate DPS SAS token using the DERIVED device key
-    azureSASTokenGenerator dpsTokenGen(AZURE_ID_SCOPE, AZURE_DEVICE_ID, deviceKey);
-    sasToken = dpsTokenGen.generateSASToken(expiry);
+    {
+        HEAP_SCOPE(HEAP_TOKEN);
+        azureSASTokenGenerator dpsTokenGen(AZURE_ID_SCOPE, AZURE_DEVICE_ID, deviceKey);
+        sasToken = dpsTokenGen.generateSASToken(expiry);
+    }
     
     if (sasToken.length() == 0) {
-        Serial.println("\nFailed to generate DPS SAS token");
+        LOG_ERROR("Failed to generate DPS SAS token");
+        dpsRetry.recordFailure();
         return;
     }
     
-    Serial.println("Generated DPS SAS Token: " + sasToken);
-    Serial.println("\nStarting Azure DPS registration...");
-    
-    // Create secure client for HTTPS
-    WiFiClientSecure client;
-    client.setInsecure();
+    // Never log the token itself
+    LOG_DEBUG("Generated DPS SAS token (%u bytes, expires %u)", sasToken.length(), expiry);
+#endif
+    LOG_INFO("Starting Azure DPS registration...");
     
-    HTTPClient http;
+    ArenaScope scope(messageArena);
     
-    // Build DPS registration URL
-    String url = String("https://") + AZURE_DPS_FQDN_ENDPOINT + "/" + AZURE_ID_SCOPE + 
-                 "/registrations/" + AZURE_DEVICE_ID + "/register?api-version=2019-03-31";
-    
-    if (!http.begin(client, url)) {
-        Serial.println("DPS: HTTP begin failed");
+    // Build DPS registration path
+    const char* path = messageArena.printf("/%s/registrations/%s/register?api-version=2019-03-31",
+                                           AZURE_ID_SCOPE, AZURE_DEVICE_ID);
+    // Create registration payload
+    const char* body = messageArena.printf("{\"registrationId\":\"%s\"}", AZURE_DEVICE_ID);
+    if (path == nullptr || body == nullptr) {
+        LOG_ERROR("DPS registration request did not fit in the message arena");
+        dpsFailures.inc();
+        dpsRetry.recordFailure();
         return;
     }
     
-    // Set headers
-    http.addHeader("Authorization", sasToken);
-    http.addHeader("Content-Type", "application/json");
-    
-    // Create registration payload
-    ArduinoJson::JsonDocument doc;
-    doc["registrationId"] = AZURE_DEVICE_ID;
+    HttpsRequest request(messageArena, "dps.register", "PUT", AZURE_DPS_FQDN_ENDPOINT, path);
     
-    String body;
-    serializeJson(doc, body);
+    // Set headers
+    applyDpsAuth(request);
+    request.addHeader("Content-Type", "application/json");
     
     // Send registration request
-    Serial.println("Sending DPS registration request...");
-    Serial.println("URL: " + url);
-    Serial.println("Body: " + body);
+    LOG_DEBUG("Sending DPS registration to https://%s%s", AZURE_DPS_FQDN_ENDPOINT, path);
+    LOG_DEBUG("Body: %s", body);
     
-    int httpCode = http.PUT((uint8_t*)body.c_str(), body.length());
-    String response = http.getString();
-    http.end();
+    int httpCode = request.send(body);
+    const char* response = request.getResponse();
+    recordHttpStatus(httpCode);
     
     if (httpCode != HTTP_CODE_ACCEPTED) {
-        Serial.printf("DPS registration failed with code: %d\n", httpCode);
-        Serial.println("Response: " + response);
+        LOG_ERROR("DPS registration failed with code: %d", httpCode);
+        dpsFailures.inc();
+        LOG_ERROR("Response: %s", response);
+        dpsRetry.recordFailure();
         return;
     }
     
     // Parse response to get operation ID
-    ArduinoJson::JsonDocument responseDoc;
-    if (deserializeJson(responseDoc, response)) {
-        Serial.println("Failed to parse DPS registration response");
+    ArduinoJson::JsonDocument responseDoc(&messageArena);
+    if (deserializeJson(responseDoc, response, request.getResponseLength())) {
+        LOG_ERROR("Failed to parse DPS registration response");
+        dpsRetry.recordFailure();
         return;
     }
     
+    dpsRetry.recordSuccess();
     dpsOperationId = responseDoc["operationId"].as<String>();
-    Serial.println("DPS registration initiated, operation ID: " + dpsOperationId);
+    dpsPollCount = 0;
+    LOG_INFO("DPS registration initiated, operation ID: %s", dpsOperationId);
     
+#if !AZURE_AUTH_X509
     // Store the derived device key for later IoT Hub use
     strncpy(iotHubDeviceKey, deviceKey.c_str(), sizeof(iotHubDeviceKey) - 1);
+#endif
     
-    // Now poll for assignment status
-    pollDPSAssignment();
+    // The provisioning task polls for the assignment from here on
 }
 
+// One status poll per call; the provisioning task calls this until the
+// registration is assigned, fails or runs out of polls
 void pollDPSAssignment() {
-    const int maxRetries = 20;
-    const int pollInterval = 3000;
+    // No registration in flight, or backing off after a failure
+    if (dpsOperationId.length() == 0 || !dpsRetry.allowRequest()) {
+        return;
+    }
     
-    for (int attempt = 0; attempt < maxRetries; attempt++) {
-        delay(pollInterval);
-        
-        WiFiClientSecure client;
-        client.setInsecure();
-        HTTPClient http;
-        
-        String url = String("https://") + AZURE_DPS_FQDN_ENDPOINT + "/" + AZURE_ID_SCOPE + 
-                     "/registrations/" + AZURE_DEVICE_ID + "/operations/" + dpsOperationId + 
-                     "?api-version=2019-03-31";
+    HEAP_SCOPE(HEAP_DPS);
+    ArenaScope scope(messageArena);
+    
+    const char* path = messageArena.printf("/%s/registrations/%s/operations/%s?api-version=2019-03-31",
+                                           AZURE_ID_SCOPE, AZURE_DEVICE_ID, dpsOperationId.c_str());
+    if (path == nullptr) {
+        dpsRetry.recordFailure();
+        return;
+    }
+    HttpsRequest request(messageArena, "dps.poll", "GET", AZURE_DPS_FQDN_ENDPOINT, path);
+    
+    applyDpsAuth(request);
+    int httpCode = request.send();
+    const char* response = request.getResponse();
+    recordHttpStatus(httpCode);
+    
+    ArduinoJson::JsonDocument doc(&messageArena);
+    if (httpCode != HTTP_CODE_OK || deserializeJson(doc, response, request.getResponseLength())) {
+        LOG_WARN("DPS status poll failed with code: %d", httpCode);
+        dpsRetry.recordFailure();
+        return;
+    }
+    dpsRetry.recordSuccess();
+    
+    const char* status = doc["status"] | "";
+    LOG_INFO("DPS Status: %s", status);
+    
+    if (strcmp(status, "assigned") == 0) {
+        // Device has been assigned to an IoT Hub
+        const char* assignedHub = doc["registrationState"]["assignedHub"] | "";
+        const char* deviceId = doc["registrationState"]["deviceId"] | "";
         
-        if (!http.begin(client, url)) {
-            Serial.println("DPS polling: HTTP begin failed");
-            continue;
-        }
+        LOG_INFO("DPS Assignment successful!");
+        dpsRegistrations.inc();
+        provisioningMs.record(millis() - provisioningStartTime);
+        LOG_INFO("Assigned Hub: %s", assignedHub);
+        LOG_INFO("Device ID: %s", deviceId);
+        dpsOperationId = "";
         
-        http.addHeader("Authorization", sasToken);
-        int httpCode = http.GET();
-        String response = http.getString();
-        http.end();
+        // Store the assignment details
+        strncpy(iotHubHost, assignedHub, sizeof(iotHubHost) - 1);
+        strncpy(iotHubDeviceId, deviceId, sizeof(iotHubDeviceId) - 1);
         
-        if (httpCode == HTTP_CODE_OK) {
-            ArduinoJson::JsonDocument doc;
-            if (!deserializeJson(doc, response)) {
-                String status = doc["status"].as<String>();
-                Serial.println("DPS Status: " + status);
-                
-                if (status == "assigned") {
-                    // Device has been assigned to an IoT Hub
-                    String assignedHub = doc["registrationState"]["assignedHub"];
-                    String deviceId = doc["registrationState"]["deviceId"];
-                    
-                    Serial.println("DPS Assignment successful!");
-                    Serial.println("Assigned Hub: " + assignedHub);
-                    Serial.println("Device ID: " + deviceId);
-                    
-                    // Store the assignment details
-                    strncpy(iotHubHost, assignedHub.c_str(), sizeof(iotHubHost) - 1);
-                    strncpy(iotHubDeviceId, deviceId.c_str(), sizeof(iotHubDeviceId) - 1);
-                    
-                    // Initialize IoT Hub client
-                    if (iotHubClient.initialize(String(iotHubHost), String(iotHubDeviceId), String(iotHubDeviceKey))) {
-                        Serial.println("IoT Hub client initialized successfully");
-                        
-                        // Send initial telemetry
-                        String payload = iotHubClient.createTelemetryPayload();
-                        if (iotHubClient.sendTelemetry(payload)) {
-                            Serial.println("Initial telemetry sent successfully");
-                        }
-                    } else {
-                        Serial.println("Failed to initialize IoT Hub client");
-                    }
-                    
-                    Serial.println("Azure DPS provisioning completed successfully");
-                    return;
-                }
-                else if (status == "failed") {
-                    Serial.println("DPS provisioning failed");
-                    Serial.println("Error details: " + response);
-                    return;
-                }
-                // If status is "assigning", continue polling
-            }
+        // Initialize IoT Hub client
+        if (iotHubClient.initialize(String(iotHubHost), String(iotHubDeviceId), String(iotHubDeviceKey))) {
+            LOG_INFO("IoT Hub client initialized successfully");
+            initialTelemetryDue = true;
+        } else {
+            LOG_ERROR("Failed to initialize IoT Hub client");
+            // Registering again straight away would fail the same way
+            dpsRetry.recordFailure();
+            return;
         }
         
-        Serial.printf("DPS polling attempt %d/%d\n", attempt + 1, maxRetries);
+        LOG_INFO("Azure DPS provisioning completed successfully");
+        return;
+    }
+    
+    if (strcmp(status, "failed") == 0) {
+        LOG_ERROR("DPS provisioning failed");
+        dpsFailures.inc();
+        LOG_ERROR("Error details: %s", response);
+        dpsOperationId = "";
+        dpsRetry.recordFailure();
+        return;
     }
     
-    Serial.println("DPS provisioning timed out");
+    // Still "assigning": keep polling, up to a limit
+    if (++dpsPollCount >= DPS_MAX_POLLS) {
+        LOG_ERROR("DPS provisioning timed out");
+        dpsFailures.inc();
+        dpsOperationId = "";
+        dpsRetry.recordFailure();
+        return;
+    }
+    LOG_INFO("DPS polling attempt %d/%d", dpsPollCount, DPS_MAX_POLLS);
 }
 
-String deriveDeviceKey(const String &enrollmentGroupKey, const String &deviceId) {
-    // Decode the enrollment group key
-    size_t keyLen;
-    uint8_t keyBin[64];
-    
-    int decodeResult = mbedtls_base64_decode(keyBin, sizeof(keyBin), &keyLen,
-                                            (const unsigned char*)enrollmentGroupKey.c_str(), 
-                                            enrollmentGroupKey.length());
-    
-    if (decodeResult != 0) {
-        Serial.printf("ERROR: Failed to decode enrollment group key: %d\n", decodeResult);
-        return String();
+// Called by the scheduler until the hub client is connected
+void provisioningStep() {
+    if (dpsOperationId.length() == 0) {
+        startAzureProvisioning();
+    } else {
+        pollDPSAssignment();
     }
     
-    // Compute HMAC-SHA256 of device ID using enrollment group key
-    uint8_t hmac[32];
-    int hmacResult = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
-                                    keyBin, keyLen,
-                                    (const uint8_t*)deviceId.c_str(), deviceId.length(), 
-                                    hmac);
-    
-    if (hmacResult != 0) {
-        Serial.printf("ERROR: HMAC computation failed: %d\n", hmacResult);
-        return String();
+    // Once the DPS request and response have been released
+    if (initialTelemetryDue) {
+        initialTelemetryDue = false;
+        if (sendTelemetryNow()) {
+            LOG_INFO("Initial telemetry sent successfully");
+        }
     }
+}
+
+// One-off derivation; use DeviceKeyDeriver directly for many devices
+String deriveDeviceKey(const String &enrollmentGroupKey, const String &deviceId) {
+    DeviceKeyDeriver deriver;
+    char deviceKey[DEVICE_KEY_BASE64_SIZE];
     
-    // Base64 encode the result
-    char deviceKey[64];
-    size_t deviceKeyLen;
-    int encodeResult = mbedtls_base64_encode((unsigned char*)deviceKey, sizeof(deviceKey), 
-                                            &deviceKeyLen, hmac, sizeof(hmac));
-    
-    if (encodeResult != 0) {
-        Serial.printf("ERROR: Failed to encode device key: %d\n", encodeResult);
+    if (!deriver.begin(enrollmentGroupKey.c_str()) ||
+        !deriver.derive(deviceId.c_str(), deviceKey, sizeof(deviceKey))) {
         return String();
     }
     
-    String derivedKey = String(deviceKey, deviceKeyLen);
-    Serial.println("Device key derived successfully");
-    
-    return derivedKey;
+    LOG_INFO("Device key derived successfully");
+    return String(deviceKey);
 }
 
-void sendTelemetryIfDue() {
-    static unsigned long lastTelemetrySent = 0;
-    const unsigned long TELEMETRY_INTERVAL = 10000; // 30 seconds in milliseconds
+// Signs hub SAS tokens and derives device keys with each backend; the
+// active backend is restored afterwards. Blocks the network task.
+void runCryptoBenchmark(uint32_t iterations) {
+    CryptoBackend* backends[] = {&mbedtlsCrypto, &espShaCrypto};
+    CryptoBackend& active = getCryptoBackend();
+    azureSASTokenGenerator tokenGen(String("benchmark.azure-devices.net"), String(AZURE_DEVICE_ID),
+                                    String(AZURE_SYMMETRIC_KEY), true);
+    uint32_t expiry = time(NULL) + 3600;
     
-    unsigned long currentTime = millis();
+    Serial.printf("Crypto benchmark, %lu iterations each\n", (unsigned long)iterations);
+    for (CryptoBackend* backend : backends) {
+        setCryptoBackend(*backend);
+        
+        int64_t start = esp_timer_get_time();
+        for (uint32_t i = 0; i < iterations; i++) {
+            tokenGen.generateSASToken(expiry + i);
+        }
+        int64_t tokenUs = esp_timer_get_time() - start;
+        
+        DeviceKeyDeriver deriver;
+        deriver.begin(AZURE_SYMMETRIC_KEY);
+        char deviceId[32];
+        char deviceKey[DEVICE_KEY_BASE64_SIZE];
+        start = esp_timer_get_time();
+        for (uint32_t i = 0; i < iterations; i++) {
+            snprintf(deviceId, sizeof(deviceId), "benchmark-%05lu", (unsigned long)i);
+            deriver.derive(deviceId, deviceKey, sizeof(deviceKey));
+        }
+        int64_t deriveUs = esp_timer_get_time() - start;
+        
+        Serial.printf("  %-8s %8.0f tokens/s %8.0f derivations/s%s\n", backend->getName(),
+                      tokenUs > 0 ? iterations * 1e6 / tokenUs : 0.0,
+                      deriveUs > 0 ? iterations * 1e6 / deriveUs : 0.0,
+                      backend == &active ? "  (active)" : "");
+    }
+    setCryptoBackend(active);
+}
+
+// OTA progress callback. The twin keeps the latest status (same shape as the
+// Node simulator's firmwareStatus). The callback can run inside a twin or
+// serial handler, so the telemetry messages are only queued here and sent
+// by the OTA task (sendFirmwareStatus).
+void reportFirmwareStatus(const char* status, const char* targetVersion, const char* error) {
+    deviceTwin.report("firmwareStatus.currentVersion", CURRENT_FIRMWARE_VERSION);
+    deviceTwin.report("firmwareStatus.status", status);
+    deviceTwin.report("firmwareStatus.targetVersion", targetVersion ? targetVersion : "");
+    deviceTwin.report("firmwareStatus.error", error ? error : "");
     
-    // Check if IoT Hub client is properly initialized
     if (!iotHubClient.isConnected()) {
-        // Reset the timer when not connected so we send immediately when reconnected
-        lastTelemetrySent = currentTime;
         return;
     }
-    
-    // Check if 30 seconds have passed since last telemetry
-    if (currentTime - lastTelemetrySent >= TELEMETRY_INTERVAL) {
-        Serial.println("Sending periodic telemetry...");
-        
-        // Create the telemetry payload
-        String payload = iotHubClient.createTelemetryPayload();
+    if (firmwareStatusCount >= FIRMWARE_STATUS_QUEUE) {
+        LOG_WARN("Firmware status %s not queued", status);
+        return;
+    }
+    FirmwareStatusMessage& message = firmwareStatusQueue[firmwareStatusCount++];
+    message.status = status;
+    snprintf(message.targetVersion, sizeof(message.targetVersion), "%s", targetVersion ? targetVersion : "");
+    snprintf(message.error, sizeof(message.error), "%s", error ? error : "");
+}
+
+// OTA task: sends the firmware status messages queued since its last run.
+// Best effort and never retried; the twin has the latest status anyway.
+void sendFirmwareStatus() {
+    for (uint8_t i = 0; i < firmwareStatusCount; i++) {
+        const FirmwareStatusMessage& message = firmwareStatusQueue[i];
+        if (!iotHubClient.isConnected()) {
+            break;
+        }
+        ArenaScope scope(messageArena);
+        if (iotHubClient.sendTelemetry(iotHubClient.createFirmwareStatusPayload(
+                message.status, message.targetVersion, message.error[0] ? message.error : nullptr))) {
+            LOG_INFO("Firmware status sent: %s", message.status);
+        }
+    }
+    firmwareStatusCount = 0;
+}
+
+// The alert lane: each alert goes out on its own as soon as the sensing core
+// queues it, ahead of routine telemetry and regardless of its schedule,
+// deadbands or rate limit backlog. Returns the delay before the next
+// attempt, or 0 once the lane is empty.
+uint32_t sendPendingAlerts() {
+    while (holdingAlert || popAlert(heldAlert)) {
+        holdingAlert = true;
+        if (!iotHubClient.isConnected()) {
+            return ALERT_RETRY_INTERVAL;
+        }
         
-        // Send to Azure IoT Hub
-        if (iotHubClient.sendTelemetry(payload)) {
-            Serial.println("Telemetry sent successfully");
-            // Update the last sent time only on successful send
-            lastTelemetrySent = currentTime;
+        ArenaScope scope(messageArena);
+        if (!iotHubClient.sendTelemetry(iotHubClient.createAlertPayload(heldAlert), true)) {
+            uint32_t retryDelayMs = iotHubClient.getRetryDelayMs();
+            if (retryDelayMs > 0) {
+                return retryDelayMs;
+            }
+            // Sending it again would fail the same way
+            LOG_ERROR("Alert %s dropped", alertName(heldAlert.type));
+            alertsDropped.inc();
         } else {
-            Serial.println("Failed to send telemetry - will retry");
-            // Don't update lastTelemetrySent so we retry sooner
+            alertLatencyMs.record(millis() - heldAlert.timestampMs);
+            alertsSent.inc();
+            LOG_INFO("Alert %s %s sent", alertName(heldAlert.type), heldAlert.raised ? "raised" : "cleared");
         }
+        holdingAlert = false;
+    }
+    return 0;
+}
+
+// The window about to be sent (or suppressed), also fed to the adaptive
+// interval along with the link quality
+static SampleRecord takeTelemetryWindow() {
+    SampleRecord window = getTelemetryWindow();
+    int32_t rssi = WiFi.RSSI();
+    wifiRssi.set(rssi);
+    adaptiveInterval.update(rssi, window.batteryLevel, window.temperatureAvg, window.humidityAvg);
+    return window;
+}
+
+// Sends the current aggregation window and starts a new one; on failure the
+// window is kept for the retry
+static bool sendTelemetryWindow(const SampleRecord& window) {
+    // Payload, request and response are released together on return
+    ArenaScope scope(messageArena);
+    
+    // Create the telemetry payload
+    const char* payload = iotHubClient.createTelemetryPayload();
+    
+    // Send to Azure IoT Hub
+    if (iotHubClient.sendTelemetry(payload)) {
+        routineLatencyMs.record(millis() - window.firstTimestampMs);
+        lastSentTemperature = window.temperatureAvg;
+        lastSentHumidity = window.humidityAvg;
+        resetTelemetryWindow();
+        return true;
+    }
+    return false;
+}
+
+// An alert held for a retry, or one still on the sensing queue
+bool alertsPending() {
+    return holdingAlert || queuedAlerts() > 0;
+}
+
+// Called by the scheduler at each telemetry deadline. Returns false only when
+// a send was attempted and failed, so the caller can schedule an early retry.
+bool sendTelemetryIfDue() {
+    // Nothing is due until provisioning has produced a hub connection
+    if (!iotHubClient.isConnected()) {
+        return true;
+    }
+    
+    // A pending alert never waits behind a routine message
+    sendPendingAlerts();
+    
+    // Inside the deadbands the readings are not worth a message; the next
+    // window is compared against the last values sent
+    SampleRecord window = takeTelemetryWindow();
+    bool quiet = !isnan(lastSentTemperature) &&
+                 millis() - iotHubClient.getLastTelemetryTime() < TELEMETRY_MAX_SILENCE &&
+                 fabsf(window.temperatureAvg - lastSentTemperature) < telemetryDeadbands.temperature &&
+                 fabsf(window.humidityAvg - lastSentHumidity) < telemetryDeadbands.humidity;
+    if (quiet) {
+        telemetrySuppressed.inc();
+        resetTelemetryWindow();
+        return true;
     }
+    
+    LOG_DEBUG("Sending periodic telemetry...");
+    if (sendTelemetryWindow(window)) {
+        return true;
+    }
+    
+    LOG_WARN("Failed to send telemetry - will retry");
+    return false;
+}
+
+// On demand (the telemetry direct method, the first message after
+// provisioning): sends the current window whatever the deadbands say,
+// without the gateway children's messages
+bool sendTelemetryNow() {
+    if (!iotHubClient.isConnected()) {
+        return false;
+    }
+    sendPendingAlerts();
+    
+    LOG_DEBUG("Sending telemetry on demand...");
+    return sendTelemetryWindow(takeTelemetryWindow());
 }
@@ -11,6 +11,82 @@
 #include <WiFiClientSecure.h>
 
 #include "secret_configs.h"
+#include "sensors.h"
+#include "metrics.h"
+#include "https_request.h"
+#include "logger.h"
+#include "message_arena.h"
+#include "heap_stats.h"
+#include "retry_policy.h"
+#include "rate_limiter.h"
+#include "prepared_request.h"
+#include "x509_credentials.h"
+#include "tls_verify.h"
+#include "gateway.h"
+#include "key_derivation.h"
+#include "crypto_backend.h"
+#include "sas_token_cache.h"
+#include "cloud_link.h"
+#include "adaptive_interval.h"
+
+#define TELEMETRY_INTERVAL 10000       // Telemetry period in milliseconds (the adaptive base)
+#define TELEMETRY_INTERVAL_MIN 1000    // Bounds for the base set through the twin and the adapted period
+#define TELEMETRY_INTERVAL_MAX 3600000
+#define TELEMETRY_RETRY_INTERVAL 5000  // Shortest retry delay after a failed send
+#define TELEMETRY_MAX_SILENCE 300000   // Longest gap the deadbands may leave between messages
+#define ALERT_RETRY_INTERVAL 1000      // Alert lane retry while there is no hub connection
+#define FIRMWARE_STATUS_QUEUE 4        // Firmware status messages held for the OTA task
+#define TOKEN_CHECK_INTERVAL 60000     // How often the token expiry is checked
+#define DPS_RETRY_INTERVAL 5000        // Shortest retry delay after a failed DPS request
+#define DPS_MAX_POLLS 20               // Status polls before a registration is abandoned
+#define RETRY_MAX_DELAY 300000         // Backoff cap for hub and DPS retries
+#define CIRCUIT_FAILURE_THRESHOLD 5    // Consecutive failures that open a circuit
+#define CIRCUIT_OPEN_INTERVAL 120000   // How long an open circuit refuses requests
+
+// Set to 1 in secret_configs.h to authenticate with the device certificate
+// in NVS (see x509_credentials.h) instead of SAS tokens. Nothing is signed
+// on the device then, so provisioning does not wait for an NTP sync.
+#ifndef AZURE_AUTH_X509
+#define AZURE_AUTH_X509 0
+#endif
+
+// Set to 1 in secret_configs.h to append the metrics registry to every message
+#ifndef TELEMETRY_INCLUDE_DIAGNOSTICS
+#define TELEMETRY_INCLUDE_DIAGNOSTICS 0
+#endif
+
+// IoT Hub tier quota; override in secret_configs.h. The daily message quota
+// is shared by every device on the hub, so each device budgets its share.
+#ifndef HUB_DAILY_MESSAGE_QUOTA
+#define HUB_DAILY_MESSAGE_QUOTA 400000  // per unit: F1 8000, S1 400000, S2 6000000, S3 300000000
+#endif
+#ifndef HUB_UNITS
+#define HUB_UNITS 1
+#endif
+#ifndef HUB_FLEET_SIZE
+#define HUB_FLEET_SIZE 1                // devices sharing the hub, gateway children included
+#endif
+#define HUB_QUOTA_HEADROOM 0.9f         // aim just under the quota
+#define HUB_QUOTA_MESSAGE_SIZE 4096     // the quota counts messages in 4 KB blocks
+#define HUB_MESSAGE_BURST 5             // sends allowed back to back after a quiet spell
+#define HUB_MESSAGES_PER_SECOND \
+    ((float)HUB_DAILY_MESSAGE_QUOTA * HUB_UNITS * HUB_QUOTA_HEADROOM / 86400.0f / HUB_FLEET_SIZE * (1 + GATEWAY_CHILD_COUNT))
+
+// Telemetry deadbands, set through the twin's desired properties. A message
+// whose readings moved less than both deadbands since the last one sent is
+// skipped. 0 sends every message.
+struct TelemetryDeadbands {
+    float temperature;
+    float humidity;
+};
+extern TelemetryDeadbands telemetryDeadbands;
+
+// Backoff and circuit breakers for the hub and DPS endpoints
+extern RetryPolicy hubRetry;
+extern RetryPolicy dpsRetry;
+
+// This device's share of the hub message quota
+extern TokenBucket hubLimiter;
 
 class azureSASTokenGenerator {
   public:
@@ -102,19 +178,16 @@ class azureSASTokenGenerator {
 
       size_t keyLen;
       uint8_t keyBin[64];
+      CryptoBackend& crypto = getCryptoBackend();
       
-      mbedtls_base64_decode(keyBin, sizeof(keyBin), &keyLen,
-                            (const unsigned char*)symmetricKey.c_str(), symmetricKey.length());                             
-      
-      uint8_t hmac[32];
-      mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
-                      keyBin, keyLen,
-                      az_span_ptr(outSig), az_span_size(outSig), 
-                      hmac);
-
+      uint8_t hmac[CRYPTO_SHA256_SIZE];
       char b64Sig[64];
       size_t b64Len;
-      mbedtls_base64_encode((unsigned char*)b64Sig, sizeof(b64Sig), &b64Len, hmac, sizeof(hmac));
+      if (!crypto.base64Decode(symmetricKey.c_str(), symmetricKey.length(), keyBin, sizeof(keyBin), &keyLen) ||
+          !crypto.hmacSha256(keyBin, keyLen, az_span_ptr(outSig), az_span_size(outSig), hmac) ||
+          !crypto.base64Encode(hmac, sizeof(hmac), b64Sig, sizeof(b64Sig), &b64Len)) {
+        return String("Signing failed");
+      }
 
       char sas[200];
       size_t sasLen;
@@ -148,103 +221,191 @@ private:
     String hubHost;
     String deviceId;
     String deviceKey;
-    azureSASTokenGenerator* tokenGenerator;
-    String currentToken;
+    int tokenHandle;                   // hub token in sasTokenCache
+    uint32_t tokenExpiry;              // expiry of the token patched into the head
     unsigned long lastTelemetryTime;
+    uint32_t retryDelayMs;
+    String telemetryPath;
+    PreparedRequest telemetryRequest;  // head serialized once per hub connection
     
 public:
-    AzureIoTHubClient() : tokenGenerator(nullptr), lastTelemetryTime(0) {}
-    
-    ~AzureIoTHubClient() {
-        if (tokenGenerator) {
-            delete tokenGenerator;
-        }
-    }
+    AzureIoTHubClient() : tokenHandle(-1), tokenExpiry(0), lastTelemetryTime(0), retryDelayMs(0) {}
     
     bool initialize(const String& host, const String& devId, const String& devKey) {
+#if AZURE_AUTH_X509
+        // Without the certificate isConnected() must stay false, or every
+        // hub send would go out without one
+        if (!deviceCredentials.isLoaded()) {
+            LOG_ERROR("No X.509 credentials for the hub connection");
+            hubHost = "";
+            deviceId = "";
+            return false;
+        }
+#endif
         hubHost = host;
         deviceId = devId;
         deviceKey = devKey;
         
-        // Create token generator for IoT Hub
-        if (tokenGenerator) {
-            delete tokenGenerator;
+        if (tokenHandle >= 0) {
+            sasTokenCache.remove(tokenHandle);
+            tokenHandle = -1;
         }
-        tokenGenerator = new azureSASTokenGenerator(hubHost, deviceId, deviceKey, true);
+        tokenExpiry = 0;
         
-        // Generate initial token
+        // Serialize the telemetry request head; refreshToken() fills in the token
+        telemetryPath = String("/devices/") + deviceId + "/messages/events?api-version=2020-03-13";
+        if (!telemetryRequest.prepare("POST", hubHost.c_str(), telemetryPath.c_str(), "application/json", 0)) {
+            LOG_ERROR("Telemetry request head does not fit in %u bytes", PREPARED_HEAD_SIZE);
+            return false;
+        }
+        
+#if AZURE_AUTH_X509
+        // The client certificate authenticates each connection; no tokens
+        return true;
+#else
+        // The cache signs and renews the hub token from here on
+        tokenHandle = sasTokenCache.add((hubHost + "/devices/" + deviceId).c_str(), deviceKey.c_str());
+        if (tokenHandle < 0) {
+            return false;
+        }
         return refreshToken();
+#endif
     }
     
+    // Patches the cache's current token into the telemetry head
     bool refreshToken() {
-        if (!tokenGenerator) {
-            Serial.println("Token generator not initialized");
+        if (tokenHandle < 0) {
+            LOG_ERROR("No hub token registered");
             return false;
         }
         
-        uint32_t expiry = time(NULL) + 3600; // 1 hour expiry
-        currentToken = tokenGenerator->generateSASToken(expiry);
+        HEAP_SCOPE(HEAP_TOKEN);
+        SasTokenView token;
+        if (!sasTokenCache.get(tokenHandle, token)) {
+            LOG_ERROR("Failed to generate IoT Hub SAS token");
+            tokenRefreshFailures.inc();
+            return false;
+        }
         
-        if (currentToken.length() == 0) {
-            Serial.println("Failed to generate IoT Hub SAS token");
+        // Patched into the prepared head in place
+        if (!telemetryRequest.setAuthorization(token.token)) {
+            LOG_ERROR("SAS token does not fit the telemetry request head");
+            tokenRefreshFailures.inc();
             return false;
         }
         
-        Serial.println("IoT Hub SAS token refreshed successfully");
+        tokenExpiry = token.expiry;
+        tokenRefreshes.inc();
+        LOG_INFO("IoT Hub SAS token refreshed successfully");
         return true;
     }
     
-    bool sendTelemetry(const String& jsonPayload) {
-        // Check if token needs refresh
-        if (tokenGenerator && tokenGenerator->IsExpired()) {
-            Serial.println("Token expired, refreshing...");
-            if (!refreshToken()) {
-                return false;
-            }
+    // Picks up a token the cache has renewed (see SasTokenCache::refreshDue)
+    // so sends never pay for signing
+    bool renewTokenIfExpiring() {
+        if (tokenHandle < 0) {
+            return true;
+        }
+        SasTokenView token;
+        if (sasTokenCache.get(tokenHandle, token) && token.expiry == tokenExpiry) {
+            return true;
         }
+        return refreshToken();
+    }
+    
+    // Every per-message string lives in messageArena; the caller resets it
+    // (see ArenaScope) once the send is complete. Urgent messages (alerts)
+    // may borrow ahead on the rate limit instead of waiting for a refill.
+    bool sendTelemetry(const char* jsonPayload, bool urgent = false) {
+        retryDelayMs = 0;
         
-        WiFiClientSecure client;
-        client.setInsecure(); // Skip certificate validation for simplicity
+        // Signs on the spot only if the renewal task fell behind
+        if (!renewTokenIfExpiring()) {
+            return false;
+        }
         
-        HTTPClient http;
+        // Backing off, or the hub circuit is open
+        if (!hubRetry.allowRequest()) {
+            retryDelayMs = hubRetry.getRetryDelayMs();
+            LOG_DEBUG("Hub requests paused for %lu ms", (unsigned long)retryDelayMs);
+            return false;
+        }
         
-        // Build IoT Hub telemetry URL
-        String url = String("https://") + hubHost + "/devices/" + deviceId + 
-                     "/messages/events?api-version=2020-03-13";
+        if (jsonPayload == nullptr) {
+            LOG_ERROR("Telemetry payload did not fit in the message arena");
+            telemetryFailed.inc();
+            return false;
+        }
         
-        if (!http.begin(client, url)) {
-            Serial.println("IoT Hub: HTTP begin failed");
+        // Stay inside the quota; the caller retries once a token is due
+        size_t payloadLength = strlen(jsonPayload);
+        size_t quotaBlocks = (payloadLength + HUB_QUOTA_MESSAGE_SIZE - 1) / HUB_QUOTA_MESSAGE_SIZE;
+        if (!(urgent ? hubLimiter.acquireUrgent(quotaBlocks) : hubLimiter.tryAcquire(quotaBlocks))) {
+            retryDelayMs = hubLimiter.getWaitMs(quotaBlocks);
+            LOG_DEBUG("Rate limited for %lu ms", (unsigned long)retryDelayMs);
             return false;
         }
         
-        // Set headers
-        http.addHeader("Authorization", currentToken);
-        http.addHeader("Content-Type", "application/json");
-        http.addHeader("iothub-messageid", String(millis())); // Simple message ID
+        // Only the per-message values change; the rest of the head was
+        // serialized at initialize()
+        telemetryRequest.setMessageId(millis()); // Simple message ID
+        telemetryRequest.setContentLength(payloadLength);
+        
+        HttpsRequest request(messageArena, "telemetry", "POST", hubHost.c_str(), telemetryRequest.getPath());
+        request.setHead(telemetryRequest.getHead(), telemetryRequest.getHeadLength());
+        request.captureErrorsOnly();
+#if AZURE_AUTH_X509
+        request.setClientCertificate(deviceCredentials.getCertificate(), deviceCredentials.getPrivateKey());
+#endif
         
-        Serial.println("Sending telemetry to IoT Hub...");
-        Serial.println("URL: " + url);
-        Serial.println("Payload: " + jsonPayload);
+        LOG_DEBUG("Sending telemetry to https://%s%s", hubHost, telemetryRequest.getPath());
+        LOG_DEBUG("Payload: %s", jsonPayload);
         
-        int httpCode = http.POST(jsonPayload);
-        String response = http.getString();
-        http.end();
+        unsigned long sendStart = millis();
+        int httpCode = request.send((const uint8_t*)jsonPayload, payloadLength);
+        telemetrySendMs.record(millis() - sendStart);
+        recordHttpStatus(httpCode);
         
         if (httpCode == HTTP_CODE_NO_CONTENT || httpCode == HTTP_CODE_OK) {
-            Serial.printf("Telemetry sent successfully (HTTP %d)\n", httpCode);
-            lastTelemetryTime = millis();
+            LOG_INFO("Telemetry sent successfully (HTTP %d)", httpCode);
+            // An alert carries no routine readings; the deadbands' silence
+            // limit still counts from the last routine message
+            if (!urgent) lastTelemetryTime = millis();
+            telemetrySent.inc();
+            hubRetry.recordSuccess();
+            hubLimiter.onAccepted();
             return true;
         } else {
-            Serial.printf("Telemetry failed with HTTP code: %d\n", httpCode);
-            if (response.length() > 0) {
-                Serial.println("Response: " + response);
+            LOG_WARN("Telemetry failed with HTTP code: %d", httpCode);
+            telemetryFailed.inc();
+            if (httpCode == 429 || httpCode == 503) {
+                telemetryThrottled.inc();
+                hubLimiter.onThrottled(request.getRetryAfterMs());
+            }
+            // A 4xx (including 429, which the limiter handles) means the hub
+            // is up; only outages should back off
+            if (isRetryableStatus(httpCode) && httpCode != 429) {
+                hubRetry.recordFailure();
+                retryDelayMs = hubRetry.getRetryDelayMs();
+            } else {
+                hubRetry.recordSuccess();
+            }
+            if (httpCode == 429 || httpCode == 503) {
+                uint32_t rateDelayMs = hubLimiter.getWaitMs(quotaBlocks);
+                if (rateDelayMs > retryDelayMs) retryDelayMs = rateDelayMs;
+            }
+            if (request.getResponseLength() > 0) {
+                LOG_WARN("Response: %s", request.getResponse());
             }
             return false;
         }
     }
     
-    String createTelemetryPayload() {
-        ArduinoJson::JsonDocument doc;
+    // Serializes into messageArena; valid until the arena is reset.
+    // Returns nullptr if the message does not fit.
+    const char* createTelemetryPayload() {
+        HEAP_SCOPE(HEAP_PAYLOAD);
+        ArduinoJson::JsonDocument doc(&messageArena);
         
         // Add device information
         doc["deviceId"] = deviceId;
@@ -256,24 +417,86 @@ public:
         // Add device status
         // doc["wifiSignalStrength"] = WiFi.RSSI();
         doc["freeHeap"] = ESP.getFreeHeap();
+        doc["largestFreeBlock"] = ESP.getMaxAllocHeap();
+        freeHeapBytes.set(ESP.getFreeHeap());
         doc["uptime"] = millis() / 1000;
         
-        // Add sample sensor data (replace with actual sensor readings)
-        doc["temperature"] = 22.5 + (random(-50, 50) / 10.0); // Simulated temperature
-        doc["humidity"] = 45.0 + (random(-100, 100) / 10.0);   // Simulated humidity
-        doc["batteryLevel"] = random(85, 100);                  // Simulated battery
+        // Add sensor readings aggregated on the sensing core since the last send
+        SampleRecord window = getTelemetryWindow();
+        doc["temperature"] = window.temperatureAvg;
+        doc["temperatureMin"] = window.temperatureMin;
+        doc["temperatureMax"] = window.temperatureMax;
+        doc["humidity"] = window.humidityAvg;
+        doc["batteryLevel"] = window.batteryLevel;
+        doc["sampleCount"] = window.sampleCount;
         
-        String payload;
-        serializeJson(doc, payload);
-        return payload;
+#if TELEMETRY_INCLUDE_DIAGNOSTICS
+        addMetricsToJson(doc["diagnostics"].to<JsonObject>());
+#endif
+        
+        return serializeToArena(doc);
+    }
+    
+    // Same shape as the Node simulator's firmwareStatus message
+    const char* createFirmwareStatusPayload(const char* status, const char* targetVersion, const char* error) {
+        ArduinoJson::JsonDocument doc(&messageArena);
+        
+        doc["messageType"] = "firmwareStatus";
+        doc["deviceId"] = deviceId;
+        doc["currentVersion"] = CURRENT_FIRMWARE_VERSION;
+        doc["status"] = status;
+        doc["timestamp"] = time(NULL);
+        if (targetVersion && targetVersion[0]) doc["targetVersion"] = targetVersion;
+        if (error) doc["error"] = error;
+        
+        return serializeToArena(doc);
+    }
+    
+    const char* createAlertPayload(const AlertRecord& alert) {
+        ArduinoJson::JsonDocument doc(&messageArena);
+        
+        doc["messageType"] = "alert";
+        doc["deviceId"] = deviceId;
+        doc["storeId"] = STORE_ID;
+        doc["region"] = REGION;
+        doc["alert"] = alertName(alert.type);
+        doc["state"] = alert.raised ? "raised" : "cleared";
+        doc["value"] = alert.value;
+        doc["threshold"] = alert.threshold;
+        // When the crossing sample was taken, not when the message went out
+        doc["timestamp"] = time(NULL) - (millis() - alert.timestampMs) / 1000;
+        
+        return serializeToArena(doc);
     }
     
+    const String& getHubHost() const { return hubHost; }
+    const String& getDeviceId() const { return deviceId; }
+    int getTokenHandle() const { return tokenHandle; }
+    
     unsigned long getLastTelemetryTime() {
         return lastTelemetryTime;
     }
     
+    // After a failed sendTelemetry(): when a retry can succeed, or 0 if
+    // retrying early will not help (e.g. a 4xx other than 429)
+    uint32_t getRetryDelayMs() const {
+        return retryDelayMs;
+    }
+    
     bool isConnected() {
-        return hubHost.length() > 0 && deviceId.length() > 0 && currentToken.length() > 0;
+        return hubHost.length() > 0 && deviceId.length() > 0 &&
+               (AZURE_AUTH_X509 || tokenExpiry > 0);
+    }
+
+private:
+    static const char* serializeToArena(ArduinoJson::JsonDocument& doc) {
+        size_t length = measureJson(doc);
+        char* payload = (char*)messageArena.allocate(length + 1);
+        if (payload == nullptr) {
+            return nullptr;
+        }
+        serializeJson(doc, payload, length + 1);
+        return payload;
     }
 };
 
@@ -283,6 +506,13 @@ extern AzureIoTHubClient iotHubClient;
 // Function declarations
 void startAzureProvisioning();
 void pollDPSAssignment();
+void provisioningStep();
 String deriveDeviceKey(const String &enrollmentGroupKey, const String &deviceId);
-void sendTelemetryIfDue();
+bool sendTelemetryIfDue();
+bool sendTelemetryNow();
+uint32_t sendPendingAlerts();
+bool alertsPending();
+void reportFirmwareStatus(const char* status, const char* targetVersion, const char* error);
+void sendFirmwareStatus();
+void runCryptoBenchmark(uint32_t iterations);
 bool initTime(const char* timezone = "UTC0");
\ No newline at end of file
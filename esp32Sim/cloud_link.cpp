@@ -0,0 +1,181 @@
+// cloud_link.cpp file - MQTT connection to IoT Hub for cloud-to-device messages
+#include <WiFi.h>
+#include <esp_timer.h>
+
+#include "cloud_link.h"
+#include "azure_helper.h"
+
+CloudLink cloudLink;
+
+static RetryPolicy cloudRetry("mqtt", CLOUD_LINK_RETRY_INTERVAL, RETRY_MAX_DELAY, CIRCUIT_FAILURE_THRESHOLD, CIRCUIT_OPEN_INTERVAL);
+
+static Counter c2dReceived("c2d.received");
+static Counter c2dAbandoned("c2d.abandoned");
+static Histogram c2dReceiveToHandleUs("c2d.receive_to_handle_us");
+
+CloudLink::CloudLink() : c2dHandler(nullptr), wakeCallback(nullptr), tokenExpiry(0) {
+    hubHost[0] = '\0';
+    deviceId[0] = '\0';
+    mqtt.onMessage(onMqttMessage);
+}
+
+uint32_t CloudLink::step() {
+    if (WiFi.status() != WL_CONNECTED || !iotHubClient.isConnected()) {
+        if (mqtt.connected()) {
+            mqtt.disconnect();
+        }
+        return CLOUD_LINK_IDLE_INTERVAL;
+    }
+
+    // The password only authenticates the CONNECT; a renewed token (or a
+    // new hub assignment) needs a new connection before the old one expires
+    if (mqtt.connected() && identityChanged()) {
+        LOG_INFO("Cloud link reconnecting with new credentials");
+        mqtt.disconnect();
+    }
+
+    if (!mqtt.connected()) {
+        if (!cloudRetry.allowRequest()) {
+            return cloudRetry.getRetryDelayMs();
+        }
+        if (!connect()) {
+            cloudRetry.recordFailure();
+            return cloudRetry.getRetryDelayMs();
+        }
+        cloudRetry.recordSuccess();
+    }
+
+    if (!mqtt.loop()) {
+        LOG_WARN("Cloud link lost");
+        return CLOUD_LINK_RETRY_INTERVAL;
+    }
+    uint32_t twinDueMs = deviceTwin.step();
+    uint32_t keepAliveDueMs = mqtt.getKeepAliveDueMs();
+    return twinDueMs < keepAliveDueMs ? twinDueMs : keepAliveDueMs;
+}
+
+bool CloudLink::publish(const char* topic, const char* payload) {
+    return mqtt.connected() && mqtt.publish(topic, payload);
+}
+
+bool CloudLink::identityChanged() {
+    if (strcmp(hubHost, iotHubClient.getHubHost().c_str()) != 0 ||
+        strcmp(deviceId, iotHubClient.getDeviceId().c_str()) != 0) {
+        return true;
+    }
+#if AZURE_AUTH_X509
+    return false;
+#else
+    SasTokenView token;
+    return sasTokenCache.get(iotHubClient.getTokenHandle(), token) && token.expiry != tokenExpiry;
+#endif
+}
+
+bool CloudLink::connect() {
+    snprintf(hubHost, sizeof(hubHost), "%s", iotHubClient.getHubHost().c_str());
+    snprintf(deviceId, sizeof(deviceId), "%s", iotHubClient.getDeviceId().c_str());
+
+    // The SDK builds the IoT Hub specific client id, user name and topics
+    az_iot_hub_client_options options = az_iot_hub_client_options_default();
+    if (az_result_failed(az_iot_hub_client_init(&hubClient,
+                                                az_span_create((uint8_t*)hubHost, strlen(hubHost)),
+                                                az_span_create((uint8_t*)deviceId, strlen(deviceId)),
+                                                &options))) {
+        LOG_ERROR("IoT Hub client initialization failed");
+        return false;
+    }
+    char clientId[128];
+    char username[256];
+    size_t length;
+    if (az_result_failed(az_iot_hub_client_get_client_id(&hubClient, clientId, sizeof(clientId), &length)) ||
+        az_result_failed(az_iot_hub_client_get_user_name(&hubClient, username, sizeof(username), &length))) {
+        LOG_ERROR("MQTT client id or user name does not fit");
+        return false;
+    }
+
+    const char* password = nullptr;
+#if AZURE_AUTH_X509
+    mqtt.setClientCertificate(deviceCredentials.getCertificate(), deviceCredentials.getPrivateKey());
+#else
+    SasTokenView token;
+    if (!sasTokenCache.get(iotHubClient.getTokenHandle(), token)) {
+        return false;
+    }
+    password = token.token;
+    tokenExpiry = token.expiry;
+#endif
+
+    unsigned long connectStart = millis();
+    if (!mqtt.connect(hubHost, clientId, username, password) ||
+        !mqtt.subscribe(AZ_IOT_HUB_CLIENT_C2D_SUBSCRIBE_TOPIC, 1) ||
+        !mqtt.subscribe(AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_SUBSCRIBE_TOPIC, 0) ||
+        !mqtt.subscribe(AZ_IOT_HUB_CLIENT_TWIN_PATCH_SUBSCRIBE_TOPIC, 0) ||
+        !mqtt.subscribe(AZ_IOT_HUB_CLIENT_METHODS_SUBSCRIBE_TOPIC, 0)) {
+        LOG_WARN("Cloud link to %s failed", hubHost);
+        mqtt.disconnect();
+        return false;
+    }
+    LOG_INFO("Cloud link connected to %s in %lu ms", hubHost, millis() - connectStart);
+    deviceTwin.onConnected();
+    return true;
+}
+
+bool CloudLink::onMqttMessage(const MqttMessage& message) {
+    CloudLink& self = cloudLink;
+
+    az_span topic = az_span_create((uint8_t*)message.topic, message.topicLength);
+    az_iot_hub_client_method_request methodRequest;
+    if (az_result_succeeded(az_iot_hub_client_methods_parse_received_topic(&self.hubClient, topic, &methodRequest))) {
+        directMethods.handleRequest(methodRequest, az_span_create((uint8_t*)message.payload, message.payloadLength),
+                                    self.mqtt.getDataReadyUs());
+        return true;
+    }
+
+    az_iot_hub_client_twin_response twinResponse;
+    if (az_result_succeeded(az_iot_hub_client_twin_parse_received_topic(&self.hubClient, topic, &twinResponse))) {
+        deviceTwin.handleMessage(twinResponse, message.payload, message.payloadLength);
+        return true;
+    }
+
+    az_iot_hub_client_c2d_request request;
+    if (az_result_failed(az_iot_hub_client_c2d_parse_received_topic(&self.hubClient, topic, &request))) {
+        LOG_WARN("Unexpected MQTT message on another topic");
+        return true;
+    }
+    c2dReceived.inc();
+
+    C2dMessage c2d;
+    c2d.messageId[0] = '\0';
+    az_span messageId;
+    if (az_result_succeeded(az_iot_message_properties_find(
+            &request.properties, AZ_SPAN_FROM_STR(AZ_IOT_MESSAGE_PROPERTIES_MESSAGE_ID), &messageId))) {
+        az_span_to_str(c2d.messageId, sizeof(c2d.messageId), messageId);
+    }
+    c2d.payload = message.payload;
+    c2d.length = message.payloadLength;
+    c2d.properties = &request.properties;
+
+    bool completed = self.c2dHandler == nullptr || self.c2dHandler(c2d);
+
+    // From the watcher seeing the bytes arrive to the handler returning:
+    // scheduler wakeup, TLS decryption, parsing and the handler itself
+    c2dReceiveToHandleUs.record((uint32_t)(esp_timer_get_time() - self.mqtt.getDataReadyUs()));
+    if (!completed) {
+        c2dAbandoned.inc();
+    }
+    return completed;
+}
+
+void CloudLink::printStatus() {
+    Serial.printf("Cloud link: %s", mqtt.connected() ? hubHost : "not connected");
+    if (c2dReceived.get() > 0) {
+        Serial.printf(", %lu C2D messages (%lu left for redelivery), receive to handle p50 %lu us, max %lu us",
+                      (unsigned long)c2dReceived.get(), (unsigned long)c2dAbandoned.get(),
+                      (unsigned long)c2dReceiveToHandleUs.percentile(0.5f),
+                      (unsigned long)c2dReceiveToHandleUs.getMax());
+    }
+    Serial.println();
+    cloudRetry.printStatus();
+    deviceTwin.printStatus();
+    directMethods.printStatus();
+}
@@ -0,0 +1,83 @@
+// cloud_link.h file - MQTT connection to IoT Hub for cloud-to-device messages
+#pragma once
+
+#include <Arduino.h>
+#include <az_iot_hub_client.h>
+
+#include "mqtt_client.h"
+#include "device_twin.h"
+#include "direct_methods.h"
+
+#define CLOUD_LINK_IDLE_INTERVAL 30000   // how often an unconnected link checks for a hub
+#define CLOUD_LINK_RETRY_INTERVAL 5000   // shortest delay before reconnecting
+#define C2D_MESSAGE_ID_MAX 64
+
+// A cloud-to-device message, valid only while the handler runs. The
+// payload is NUL-terminated in place.
+struct C2dMessage {
+    char messageId[C2D_MESSAGE_ID_MAX];
+    char* payload;
+    size_t length;
+    az_iot_message_properties* properties;   // for az_iot_message_properties_find()
+};
+
+// Returning true completes the message. MQTT has no abandon or reject:
+// returning false leaves it unacknowledged, and IoT Hub delivers it again
+// after the next reconnect.
+typedef bool (*C2dHandler)(const C2dMessage& message);
+
+// Telemetry stays on HTTPS; this link carries what the cloud sends to the
+// device (C2D messages, twin updates, direct methods) and what goes back
+// (reported properties, method responses). It stays open while the device has a hub, so a message is
+// pushed the moment it is enqueued instead of waiting for a poll (IoT Hub's
+// HTTPS receive endpoint does not long-poll; every check would be a billed
+// request). Authenticates like the telemetry client: a SAS token from
+// sasTokenCache as the password, reconnecting when the cache renews it, or
+// the device certificate in X.509 mode.
+// Network task only.
+class CloudLink {
+public:
+    CloudLink();
+
+    void onCloudMessage(C2dHandler handler) { c2dHandler = handler; }
+
+    // Runs on the watcher task when data arrives, or from requestStep();
+    // should schedule step()
+    void onData(void (*callback)()) {
+        wakeCallback = callback;
+        mqtt.onData(callback);
+    }
+
+    // Has step() run soon, e.g. when a reported patch is queued
+    void requestStep() {
+        if (wakeCallback) wakeCallback();
+    }
+
+    // QoS 0 on the open connection; false while disconnected
+    bool publish(const char* topic, const char* payload);
+
+    // For building topics with the SDK; valid while connected
+    const az_iot_hub_client* getHubClient() const { return &hubClient; }
+
+    // Connects once iotHubClient has a hub, handles whatever has arrived and
+    // keeps the connection alive. Returns the delay in ms before the next step.
+    uint32_t step();
+
+    bool isConnected() { return mqtt.connected(); }
+    void printStatus();
+
+private:
+    MqttClient mqtt;
+    C2dHandler c2dHandler;
+    void (*wakeCallback)();
+    az_iot_hub_client hubClient;
+    char hubHost[128];           // identity of the open connection
+    char deviceId[64];
+    uint32_t tokenExpiry;        // of the SAS token it authenticated with
+
+    bool connect();
+    bool identityChanged();
+    static bool onMqttMessage(const MqttMessage& message);
+};
+
+extern CloudLink cloudLink;
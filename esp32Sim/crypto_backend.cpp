@@ -0,0 +1,78 @@
+// crypto_backend.cpp file - HMAC-SHA256 and base64 behind a swappable backend
+#include <mbedtls/base64.h>
+#include <mbedtls/md.h>
+#include <soc/soc_caps.h>
+#if CONFIG_IDF_TARGET_ESP32
+#include <sha/sha_parallel_engine.h>
+#elif SOC_SHA_SUPPORT_DMA
+#include <sha/sha_dma.h>
+#else
+#include <sha/sha_block.h>
+#endif
+
+#include "crypto_backend.h"
+
+#define SHA256_BLOCK_SIZE 64
+
+MbedtlsCrypto mbedtlsCrypto;
+EspShaCrypto espShaCrypto;
+
+#if CRYPTO_BACKEND == CRYPTO_BACKEND_ESP_SHA
+static CryptoBackend* activeBackend = &espShaCrypto;
+#else
+static CryptoBackend* activeBackend = &mbedtlsCrypto;
+#endif
+
+CryptoBackend& getCryptoBackend() {
+    return *activeBackend;
+}
+
+void setCryptoBackend(CryptoBackend& backend) {
+    activeBackend = &backend;
+}
+
+bool CryptoBackend::base64Encode(const uint8_t* data, size_t length, char* out, size_t size, size_t* outLength) {
+    return mbedtls_base64_encode((unsigned char*)out, size, outLength, data, length) == 0;
+}
+
+bool CryptoBackend::base64Decode(const char* text, size_t length, uint8_t* out, size_t size, size_t* outLength) {
+    return mbedtls_base64_decode(out, size, outLength, (const unsigned char*)text, length) == 0;
+}
+
+bool MbedtlsCrypto::hmacSha256(const uint8_t* key, size_t keyLength, const uint8_t* data, size_t length,
+                               uint8_t digest[CRYPTO_SHA256_SIZE]) {
+    return mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, keyLength, data, length, digest) == 0;
+}
+
+bool EspShaCrypto::hmacSha256(const uint8_t* key, size_t keyLength, const uint8_t* data, size_t length,
+                              uint8_t digest[CRYPTO_SHA256_SIZE]) {
+    if (length > ESP_SHA_HMAC_MAX_DATA) {
+        return mbedtlsCrypto.hmacSha256(key, keyLength, data, length, digest);
+    }
+
+    // Keys longer than a block are hashed first; shorter ones zero-padded
+    uint8_t block[SHA256_BLOCK_SIZE] = {0};
+    if (keyLength > SHA256_BLOCK_SIZE) {
+        esp_sha(SHA2_256, key, keyLength, block);
+    } else {
+        memcpy(block, key, keyLength);
+    }
+
+    // inner = SHA256((K ^ ipad) || data)
+    uint8_t inner[SHA256_BLOCK_SIZE + ESP_SHA_HMAC_MAX_DATA];
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++) inner[i] = block[i] ^ 0x36;
+    memcpy(inner + SHA256_BLOCK_SIZE, data, length);
+    uint8_t innerDigest[CRYPTO_SHA256_SIZE];
+    esp_sha(SHA2_256, inner, SHA256_BLOCK_SIZE + length, innerDigest);
+
+    // digest = SHA256((K ^ opad) || inner)
+    uint8_t outer[SHA256_BLOCK_SIZE + CRYPTO_SHA256_SIZE];
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++) outer[i] = block[i] ^ 0x5c;
+    memcpy(outer + SHA256_BLOCK_SIZE, innerDigest, CRYPTO_SHA256_SIZE);
+    esp_sha(SHA2_256, outer, sizeof(outer), digest);
+
+    memset(block, 0, sizeof(block));
+    memset(inner, 0, SHA256_BLOCK_SIZE);
+    memset(outer, 0, SHA256_BLOCK_SIZE);
+    return true;
+}
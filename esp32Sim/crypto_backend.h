@@ -0,0 +1,56 @@
+// crypto_backend.h file - HMAC-SHA256 and base64 behind a swappable backend
+#pragma once
+
+#include <Arduino.h>
+
+#include "secret_configs.h"
+
+#define CRYPTO_BACKEND_MBEDTLS 0   // mbedtls_md_hmac (hardware SHA when mbedTLS is built with it)
+#define CRYPTO_BACKEND_ESP_SHA 1   // HMAC built directly on the one-shot esp_sha() engine
+
+// Override in secret_configs.h; runCryptoBenchmark() shows which is faster
+#ifndef CRYPTO_BACKEND
+#define CRYPTO_BACKEND CRYPTO_BACKEND_MBEDTLS
+#endif
+
+#define CRYPTO_SHA256_SIZE 32
+
+// The primitives SAS signing and device key derivation are built from.
+// Returns false on failure (bad input, buffer too small).
+class CryptoBackend {
+public:
+    virtual ~CryptoBackend() {}
+
+    virtual const char* getName() const = 0;
+    virtual bool hmacSha256(const uint8_t* key, size_t keyLength, const uint8_t* data, size_t length,
+                            uint8_t digest[CRYPTO_SHA256_SIZE]) = 0;
+
+    // Both backends use mbedTLS for base64; there is no base64 hardware
+    virtual bool base64Encode(const uint8_t* data, size_t length, char* out, size_t size, size_t* outLength);
+    virtual bool base64Decode(const char* text, size_t length, uint8_t* out, size_t size, size_t* outLength);
+};
+
+class MbedtlsCrypto : public CryptoBackend {
+public:
+    const char* getName() const override { return "mbedtls"; }
+    bool hmacSha256(const uint8_t* key, size_t keyLength, const uint8_t* data, size_t length,
+                    uint8_t digest[CRYPTO_SHA256_SIZE]) override;
+};
+
+// HMAC (RFC 2104) as two one-shot esp_sha() calls over stack buffers: no
+// md context to allocate and set up per signature. Messages longer than
+// ESP_SHA_HMAC_MAX_DATA fall back to mbedTLS.
+#define ESP_SHA_HMAC_MAX_DATA 256
+class EspShaCrypto : public CryptoBackend {
+public:
+    const char* getName() const override { return "esp_sha"; }
+    bool hmacSha256(const uint8_t* key, size_t keyLength, const uint8_t* data, size_t length,
+                    uint8_t digest[CRYPTO_SHA256_SIZE]) override;
+};
+
+extern MbedtlsCrypto mbedtlsCrypto;
+extern EspShaCrypto espShaCrypto;
+
+// The backend used for signing and derivation (CRYPTO_BACKEND at boot)
+CryptoBackend& getCryptoBackend();
+void setCryptoBackend(CryptoBackend& backend);
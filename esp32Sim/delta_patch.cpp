@@ -0,0 +1,272 @@
+// delta_patch.cpp file - Streaming binary delta patch decoder
+#include <esp_ota_ops.h>
+
+#include "delta_patch.h"
+
+#define DELTA_OP_END 0x00
+#define DELTA_OP_COPY 0x01
+#define DELTA_OP_LITERAL 0x02
+
+static uint32_t readLe32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+DeltaPatcher::DeltaPatcher() {
+    mbedtls_sha256_init(&sourceSha);
+    reset(nullptr);
+}
+
+void DeltaPatcher::reset(DeltaSink* newSink) {
+    sink = newSink;
+    source = nullptr;
+    state = STATE_HEADER;
+    error = nullptr;
+    headerUsed = 0;
+    compressed = false;
+    sourceSize = 0;
+    targetSize = 0;
+    mbedtls_sha256_free(&sourceSha);
+    mbedtls_sha256_init(&sourceSha);
+    sourceHashed = 0;
+    opcode = 0;
+    varint = 0;
+    varintShift = 0;
+    opLength = 0;
+    sourcePos = 0;
+    windowPos = 0;
+    flags = 0;
+    flagBits = 0;
+    pendingByte = -1;
+    memset(window, 0, sizeof(window));
+}
+
+bool DeltaPatcher::fail(const char* message) {
+    state = STATE_ERROR;
+    error = message;
+    return false;
+}
+
+bool DeltaPatcher::write(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (state == STATE_ERROR) {
+            return false;
+        }
+        if (state == STATE_DONE) {
+            return fail("data after end of patch");
+        }
+        if (state == STATE_VERIFY) {
+            return fail("patch data before the source was verified");
+        }
+
+        if (state == STATE_HEADER) {
+            header[headerUsed++] = data[i];
+            if (headerUsed == DELTA_HEADER_SIZE && !parseHeader()) {
+                return false;
+            }
+            continue;
+        }
+
+        // Literal runs in an uncompressed patch go straight to the sink
+        if (!compressed && state == STATE_LITERAL) {
+            size_t run = length - i;
+            if (run > opLength) run = opLength;
+            if (!sink->writeImage(data + i, run)) {
+                return fail("image write failed");
+            }
+            opLength -= run;
+            i += run - 1;
+            if (opLength == 0) {
+                state = STATE_OPCODE;
+            }
+            continue;
+        }
+
+        if (!(compressed ? decompress(data[i]) : emitOpByte(data[i]))) {
+            return false;
+        }
+    }
+    return state != STATE_ERROR;
+}
+
+bool DeltaPatcher::parseHeader() {
+    if (memcmp(header, DELTA_MAGIC, 4) != 0) {
+        return fail("not a delta patch");
+    }
+    if (header[4] != DELTA_FORMAT_VERSION) {
+        return fail("unsupported delta version");
+    }
+    compressed = (header[5] & DELTA_FLAG_LZSS) != 0;
+    sourceSize = readLe32(header + 8);
+    targetSize = readLe32(header + 12);
+
+    source = esp_ota_get_running_partition();
+    if (source == nullptr || sourceSize > source->size) {
+        return fail("source image does not fit the running partition");
+    }
+
+    // The patch is only valid against the exact image it was built from;
+    // verifySource() hashes it before any op is accepted
+    mbedtls_sha256_starts(&sourceSha, 0);
+    sourceHashed = 0;
+    state = STATE_VERIFY;
+    return true;
+}
+
+bool DeltaPatcher::verifySource(uint32_t budgetMs) {
+    if (state != STATE_VERIFY) {
+        return state != STATE_ERROR;
+    }
+
+    uint8_t buffer[DELTA_COPY_BUFFER];
+    unsigned long start = millis();
+    do {
+        if (sourceHashed == sourceSize) {
+            uint8_t hash[32];
+            mbedtls_sha256_finish(&sourceSha, hash);
+            if (memcmp(hash, header + 16, sizeof(hash)) != 0) {
+                return fail("patch was built for a different firmware image");
+            }
+            if (!sink->beginImage(targetSize)) {
+                return fail("could not start image");
+            }
+            state = STATE_OPCODE;
+            return true;
+        }
+        uint32_t chunk = sourceSize - sourceHashed < sizeof(buffer) ? sourceSize - sourceHashed : sizeof(buffer);
+        if (esp_partition_read(source, sourceHashed, buffer, chunk) != ESP_OK) {
+            return fail("source read failed");
+        }
+        mbedtls_sha256_update(&sourceSha, buffer, chunk);
+        sourceHashed += chunk;
+    } while (millis() - start < budgetMs);
+    return true;
+}
+
+// LZSS: a flag byte announces eight items, LSB first. A set bit is a
+// literal byte; a clear bit is a two-byte back-reference holding a 12-bit
+// distance - 1 and a 4-bit length - DELTA_MIN_MATCH.
+bool DeltaPatcher::decompress(uint8_t byte) {
+    if (flagBits == 0) {
+        flags = byte;
+        flagBits = 8;
+        return true;
+    }
+
+    if (flags & 1) {
+        flags >>= 1;
+        flagBits--;
+        window[windowPos] = byte;
+        windowPos = (windowPos + 1) & (DELTA_WINDOW_SIZE - 1);
+        return emitOpByte(byte);
+    }
+
+    if (pendingByte < 0) {
+        pendingByte = byte;
+        return true;
+    }
+
+    uint16_t distance = (uint16_t)((pendingByte | (byte & 0xF0) << 4) + 1);
+    uint8_t matchLength = (byte & 0x0F) + DELTA_MIN_MATCH;
+    pendingByte = -1;
+    flags >>= 1;
+    flagBits--;
+
+    for (uint8_t i = 0; i < matchLength; i++) {
+        uint8_t value = window[(windowPos - distance) & (DELTA_WINDOW_SIZE - 1)];
+        window[windowPos] = value;
+        windowPos = (windowPos + 1) & (DELTA_WINDOW_SIZE - 1);
+        if (!emitOpByte(value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DeltaPatcher::readVarint(uint8_t byte, bool& done) {
+    if (varintShift > 28) {
+        return fail("malformed varint");
+    }
+    varint |= (uint32_t)(byte & 0x7F) << varintShift;
+    varintShift += 7;
+    done = (byte & 0x80) == 0;
+    return true;
+}
+
+bool DeltaPatcher::emitOpByte(uint8_t byte) {
+    bool done = false;
+
+    switch (state) {
+        case STATE_OPCODE:
+            opcode = byte;
+            varint = 0;
+            varintShift = 0;
+            if (opcode == DELTA_OP_END) {
+                state = STATE_DONE;
+            } else if (opcode == DELTA_OP_COPY || opcode == DELTA_OP_LITERAL) {
+                state = STATE_LENGTH;
+            } else {
+                return fail("unknown delta op");
+            }
+            return true;
+
+        case STATE_LENGTH:
+            if (!readVarint(byte, done)) return false;
+            if (!done) return true;
+            opLength = varint;
+            varint = 0;
+            varintShift = 0;
+            if (opcode == DELTA_OP_COPY) {
+                state = STATE_OFFSET;
+            } else {
+                state = opLength > 0 ? STATE_LITERAL : STATE_OPCODE;
+            }
+            return true;
+
+        case STATE_OFFSET: {
+            if (!readVarint(byte, done)) return false;
+            if (!done) return true;
+            int32_t offsetDelta = (int32_t)(varint >> 1) ^ -(int32_t)(varint & 1);
+            state = STATE_OPCODE;
+            return copyFromSource(offsetDelta, opLength);
+        }
+
+        case STATE_LITERAL:
+            if (!sink->writeImage(&byte, 1)) {
+                return fail("image write failed");
+            }
+            if (--opLength == 0) {
+                state = STATE_OPCODE;
+            }
+            return true;
+
+        case STATE_DONE:
+            return fail("data after end of patch");
+
+        default:
+            return false;
+    }
+}
+
+bool DeltaPatcher::copyFromSource(int32_t offsetDelta, uint32_t length) {
+    int64_t start = (int64_t)sourcePos + offsetDelta;
+    if (start < 0 || start + length > sourceSize) {
+        return fail("copy outside the source image");
+    }
+
+    uint8_t buffer[DELTA_COPY_BUFFER];
+    uint32_t offset = (uint32_t)start;
+    uint32_t left = length;
+    while (left > 0) {
+        uint32_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+        if (esp_partition_read(source, offset, buffer, chunk) != ESP_OK) {
+            return fail("source read failed");
+        }
+        if (!sink->writeImage(buffer, chunk)) {
+            return fail("image write failed");
+        }
+        offset += chunk;
+        left -= chunk;
+    }
+    sourcePos = offset;
+    return true;
+}
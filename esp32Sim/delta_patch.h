@@ -0,0 +1,111 @@
+// delta_patch.h file - Streaming binary delta patch decoder
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+#define DELTA_MAGIC "ESPD"
+#define DELTA_FORMAT_VERSION 1
+#define DELTA_HEADER_SIZE 48         // magic, version, flags, reserved, sizes, source SHA-256
+#define DELTA_FLAG_LZSS 0x01         // op stream is LZSS compressed
+#define DELTA_WINDOW_SIZE 4096       // LZSS window; also the largest back-reference
+#define DELTA_MIN_MATCH 3
+#define DELTA_COPY_BUFFER 256        // bytes read from the source partition at a time
+
+// Receives the reconstructed image
+class DeltaSink {
+public:
+    virtual ~DeltaSink() {}
+    virtual bool beginImage(size_t targetSize) = 0;
+    virtual bool writeImage(const uint8_t* data, size_t length) = 0;
+};
+
+// Applies a patch produced by nodeSim/make-delta.js as it is downloaded.
+//
+// Layout: a 48-byte header (magic "ESPD", version, flags, two reserved
+// bytes, source size and target size as little-endian u32, SHA-256 of the
+// source image) followed by an op stream, LZSS compressed when
+// DELTA_FLAG_LZSS is set. Ops are a one-byte code followed by varints:
+//   0x00 END
+//   0x01 COPY    length, zigzag offset relative to the end of the last copy
+//   0x02 LITERAL length, then that many bytes
+//
+// COPY reads from the running app partition, so the patch only applies to
+// the image it was made against; the source hash is checked before any
+// output is produced. Hashing a multi-MB partition takes too long for one
+// step, so once the header is in the caller runs verifySource() in slices
+// and only feeds the ops after it. RAM use is the LZSS window plus a small
+// copy buffer, whatever the image size.
+class DeltaPatcher {
+public:
+    DeltaPatcher();
+
+    void reset(DeltaSink* sink);
+
+    // Feeds downloaded patch bytes. Returns false on a malformed patch, a
+    // source mismatch or a sink error; see getError().
+    bool write(const uint8_t* data, size_t length);
+
+    // Patch bytes still missing from the header (0 once it is in); write()
+    // must not be given more than this until the source is verified
+    size_t getHeaderRemaining() const { return state == STATE_HEADER ? DELTA_HEADER_SIZE - headerUsed : 0; }
+
+    // Hashes the running image DELTA_COPY_BUFFER bytes at a time for about
+    // budgetMs; once the whole source is hashed it is checked against the
+    // header and the ops may follow. False on a mismatch or read error.
+    bool isVerifyingSource() const { return state == STATE_VERIFY; }
+    bool verifySource(uint32_t budgetMs);
+
+    bool isComplete() const { return state == STATE_DONE; }
+    size_t getTargetSize() const { return targetSize; }
+    const char* getError() const { return error; }
+
+private:
+    enum State : uint8_t {
+        STATE_HEADER,
+        STATE_VERIFY,
+        STATE_OPCODE,
+        STATE_LENGTH,
+        STATE_OFFSET,
+        STATE_LITERAL,
+        STATE_DONE,
+        STATE_ERROR
+    };
+
+    DeltaSink* sink;
+    const esp_partition_t* source;
+    State state;
+    const char* error;
+
+    uint8_t header[DELTA_HEADER_SIZE];
+    size_t headerUsed;
+    bool compressed;
+    uint32_t sourceSize;
+    uint32_t targetSize;
+
+    // Source check
+    mbedtls_sha256_context sourceSha;
+    uint32_t sourceHashed;
+
+    // Op decoder
+    uint8_t opcode;
+    uint32_t varint;
+    uint8_t varintShift;
+    uint32_t opLength;
+    uint32_t sourcePos;
+
+    // LZSS decoder
+    uint8_t window[DELTA_WINDOW_SIZE];
+    uint16_t windowPos;
+    uint8_t flags;
+    uint8_t flagBits;
+    int16_t pendingByte;     // first byte of a back-reference, -1 if none
+
+    bool parseHeader();
+    bool decompress(uint8_t byte);
+    bool emitOpByte(uint8_t byte);
+    bool readVarint(uint8_t byte, bool& done);
+    bool copyFromSource(int32_t offsetDelta, uint32_t length);
+    bool fail(const char* message);
+};
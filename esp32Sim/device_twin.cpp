@@ -0,0 +1,293 @@
+// device_twin.cpp file - Device twin desired and reported properties over MQTT
+#include "device_twin.h"
+#include "cloud_link.h"
+#include "message_arena.h"
+#include "logger.h"
+#include "metrics.h"
+
+#define TWIN_RESPONSE_TIMEOUT 30000  // ms before an unanswered GET or patch is given up on
+
+DeviceTwin deviceTwin;
+
+static Counter twinPatchesSent("twin.patches_sent");
+static Counter twinUpdatesCoalesced("twin.updates_coalesced");
+static Counter twinDesiredUpdates("twin.desired_updates");
+static Histogram twinPatchBytes("twin.patch_bytes");
+
+DeviceTwin::DeviceTwin()
+    : propertyCount(0), desiredHandler(nullptr), desiredVersion(0), windowStart(0), windowOpen(false),
+      nextRequestId(1), getRequestId(0), patchRequestId(0), requestSentMs(0) {}
+
+DeviceTwin::Property* DeviceTwin::slot(const char* name, ValueType type, bool& created) {
+    created = false;
+    for (uint8_t i = 0; i < propertyCount; i++) {
+        if (strcmp(properties[i].name, name) == 0) {
+            created = properties[i].type != type;
+            properties[i].type = type;
+            return &properties[i];
+        }
+    }
+    if (propertyCount >= TWIN_REPORTED_MAX) {
+        LOG_ERROR("Twin: no room to report %s", name);
+        return nullptr;
+    }
+    Property& property = properties[propertyCount++];
+    property.name = name;
+    property.type = type;
+    property.state = TWIN_REPORTED;
+    created = true;
+    return &property;
+}
+
+void DeviceTwin::report(const char* name, int32_t value) {
+    bool created;
+    Property* property = slot(name, TWIN_INT, created);
+    if (property == nullptr || (!created && property->value.i == value)) return;
+    property->value.i = value;
+    markPending(*property);
+}
+
+void DeviceTwin::report(const char* name, float value) {
+    bool created;
+    Property* property = slot(name, TWIN_FLOAT, created);
+    if (property == nullptr || (!created && property->value.f == value)) return;
+    property->value.f = value;
+    markPending(*property);
+}
+
+void DeviceTwin::report(const char* name, bool value) {
+    bool created;
+    Property* property = slot(name, TWIN_BOOL, created);
+    if (property == nullptr || (!created && property->value.b == value)) return;
+    property->value.b = value;
+    markPending(*property);
+}
+
+void DeviceTwin::report(const char* name, const char* value) {
+    bool created;
+    Property* property = slot(name, TWIN_TEXT, created);
+    if (property == nullptr || (!created && strncmp(property->text, value, TWIN_TEXT_MAX - 1) == 0)) return;
+    snprintf(property->text, sizeof(property->text), "%s", value);
+    markPending(*property);
+}
+
+// A value superseding one in flight is simply sent again with the next patch
+void DeviceTwin::markPending(Property& property) {
+    property.state = TWIN_PENDING;
+    if (windowOpen) {
+        twinUpdatesCoalesced.inc();
+        return;
+    }
+    windowOpen = true;
+    windowStart = millis();
+    cloudLink.requestStep();
+}
+
+uint32_t DeviceTwin::step() {
+    uint32_t now = millis();
+    if ((getRequestId != 0 || patchRequestId != 0) && now - requestSentMs > TWIN_RESPONSE_TIMEOUT) {
+        LOG_WARN("Twin request %lu not answered", (unsigned long)(getRequestId ? getRequestId : patchRequestId));
+        getRequestId = 0;
+        requeueInFlight();
+    }
+
+    if (!windowOpen) {
+        return UINT32_MAX;
+    }
+    uint32_t elapsed = now - windowStart;
+    if (elapsed < TWIN_REPORT_WINDOW) {
+        return TWIN_REPORT_WINDOW - elapsed;
+    }
+    // One request at a time: the GET may still drop values the twin has,
+    // and patches must not overtake each other
+    if (getRequestId != 0 || patchRequestId != 0 || !sendPatch()) {
+        return TWIN_REPORT_WINDOW;
+    }
+    return UINT32_MAX;
+}
+
+void DeviceTwin::onConnected() {
+    requeueInFlight();
+
+    // The full twin: desired changes made while offline, and the reported
+    // values it already holds
+    char requestId[12];
+    snprintf(requestId, sizeof(requestId), "%lu", (unsigned long)nextRequestId);
+    char topic[TWIN_TOPIC_MAX];
+    size_t topicLength;
+    if (az_result_failed(az_iot_hub_client_twin_document_get_publish_topic(
+            cloudLink.getHubClient(), az_span_create_from_str(requestId), topic, sizeof(topic), &topicLength)) ||
+        !cloudLink.publish(topic, "")) {
+        LOG_WARN("Twin GET could not be sent");
+        return;
+    }
+    getRequestId = nextRequestId++;
+    requestSentMs = millis();
+}
+
+bool DeviceTwin::sendPatch() {
+    ArenaScope scope(messageArena);
+    ArduinoJson::JsonDocument doc(&messageArena);
+
+    for (uint8_t i = 0; i < propertyCount; i++) {
+        Property& property = properties[i];
+        if (property.state != TWIN_PENDING) continue;
+
+        JsonVariant target;
+        const char* dot = strchr(property.name, '.');
+        if (dot == nullptr) {
+            target = doc[property.name].to<JsonVariant>();
+        } else {
+            char group[32];
+            snprintf(group, sizeof(group), "%.*s", (int)(dot - property.name), property.name);
+            JsonObject object = doc[group].is<JsonObject>() ? doc[group].as<JsonObject>() : doc[group].to<JsonObject>();
+            target = object[dot + 1].to<JsonVariant>();
+        }
+        switch (property.type) {
+            case TWIN_INT: target = property.value.i; break;
+            case TWIN_FLOAT: target = property.value.f; break;
+            case TWIN_BOOL: target = property.value.b; break;
+            case TWIN_TEXT: target = (const char*)property.text; break;
+        }
+    }
+
+    size_t length = measureJson(doc);
+    char* body = (char*)messageArena.allocate(length + 1);
+    if (body == nullptr) {
+        return false;
+    }
+    serializeJson(doc, body, length + 1);
+
+    char requestId[12];
+    snprintf(requestId, sizeof(requestId), "%lu", (unsigned long)nextRequestId);
+    char topic[TWIN_TOPIC_MAX];
+    size_t topicLength;
+    if (az_result_failed(az_iot_hub_client_twin_patch_get_publish_topic(
+            cloudLink.getHubClient(), az_span_create_from_str(requestId), topic, sizeof(topic), &topicLength)) ||
+        !cloudLink.publish(topic, body)) {
+        return false;
+    }
+
+    patchRequestId = nextRequestId++;
+    requestSentMs = millis();
+    for (uint8_t i = 0; i < propertyCount; i++) {
+        if (properties[i].state == TWIN_PENDING) properties[i].state = TWIN_IN_FLIGHT;
+    }
+    windowOpen = false;
+    twinPatchesSent.inc();
+    twinPatchBytes.record(length);
+    LOG_DEBUG("Twin patch: %s", body);
+    return true;
+}
+
+void DeviceTwin::requeueInFlight() {
+    patchRequestId = 0;
+    for (uint8_t i = 0; i < propertyCount; i++) {
+        if (properties[i].state == TWIN_IN_FLIGHT) {
+            properties[i].state = TWIN_PENDING;
+            if (!windowOpen) {
+                windowOpen = true;
+                windowStart = millis();
+            }
+        }
+    }
+}
+
+void DeviceTwin::handleMessage(const az_iot_hub_client_twin_response& response, char* payload, size_t length) {
+    ArenaScope scope(messageArena);
+    ArduinoJson::JsonDocument doc(&messageArena);
+    uint32_t version = 0;
+
+    if (response.response_type == AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_DESIRED_PROPERTIES) {
+        az_span_atou32(response.version, &version);
+        if (deserializeJson(doc, payload, length)) {
+            LOG_WARN("Twin: desired patch is not valid JSON");
+            return;
+        }
+        applyDesired(doc.as<JsonObjectConst>(), version);
+        return;
+    }
+
+    uint32_t requestId = 0;
+    az_span_atou32(response.request_id, &requestId);
+    bool accepted = response.status >= 200 && response.status < 300;
+
+    if (requestId != 0 && requestId == getRequestId) {
+        getRequestId = 0;
+        if (!accepted || deserializeJson(doc, payload, length)) {
+            LOG_WARN("Twin GET failed (status %d)", (int)response.status);
+            return;
+        }
+        JsonObjectConst desired = doc["desired"].as<JsonObjectConst>();
+        dropReported(doc["reported"].as<JsonObjectConst>());
+        applyDesired(desired, desired["$version"] | 0UL);
+    } else if (requestId != 0 && requestId == patchRequestId) {
+        if (accepted) {
+            patchRequestId = 0;
+            for (uint8_t i = 0; i < propertyCount; i++) {
+                if (properties[i].state == TWIN_IN_FLIGHT) properties[i].state = TWIN_REPORTED;
+            }
+        } else {
+            LOG_WARN("Twin patch rejected (status %d)", (int)response.status);
+            requeueInFlight();
+        }
+    }
+}
+
+void DeviceTwin::applyDesired(JsonObjectConst desired, uint32_t version) {
+    // A patch already covered by the full twin, or one seen before
+    if (version != 0 && version <= desiredVersion) {
+        return;
+    }
+    desiredVersion = version;
+    twinDesiredUpdates.inc();
+    LOG_INFO("Twin desired properties, version %lu", (unsigned long)version);
+    if (desiredHandler != nullptr) {
+        desiredHandler(desired);
+    }
+}
+
+// Pending values the twin already holds need not be sent again
+void DeviceTwin::dropReported(JsonObjectConst reported) {
+    bool anyPending = false;
+    for (uint8_t i = 0; i < propertyCount; i++) {
+        Property& property = properties[i];
+        if (property.state != TWIN_PENDING) continue;
+        if (matches(property, lookup(reported, property.name))) {
+            property.state = TWIN_REPORTED;
+        } else {
+            anyPending = true;
+        }
+    }
+    windowOpen = anyPending;
+}
+
+bool DeviceTwin::matches(const Property& property, JsonVariantConst value) {
+    switch (property.type) {
+        case TWIN_INT: return value.is<int32_t>() && value.as<int32_t>() == property.value.i;
+        case TWIN_FLOAT: return value.is<float>() && value.as<float>() == property.value.f;
+        case TWIN_BOOL: return value.is<bool>() && value.as<bool>() == property.value.b;
+        case TWIN_TEXT: return value.is<const char*>() && strcmp(value.as<const char*>(), property.text) == 0;
+    }
+    return false;
+}
+
+JsonVariantConst DeviceTwin::lookup(JsonObjectConst object, const char* name) {
+    const char* dot = strchr(name, '.');
+    if (dot == nullptr) {
+        return object[name];
+    }
+    char group[32];
+    snprintf(group, sizeof(group), "%.*s", (int)(dot - name), name);
+    return object[group][dot + 1];
+}
+
+void DeviceTwin::printStatus() {
+    uint8_t pending = 0;
+    for (uint8_t i = 0; i < propertyCount; i++) {
+        if (properties[i].state != TWIN_REPORTED) pending++;
+    }
+    Serial.printf("Twin: desired v%lu, %u reported properties (%u pending), %lu patches sent, %lu updates coalesced\n",
+                  (unsigned long)desiredVersion, propertyCount, pending,
+                  (unsigned long)twinPatchesSent.get(), (unsigned long)twinUpdatesCoalesced.get());
+}
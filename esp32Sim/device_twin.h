@@ -0,0 +1,90 @@
+// device_twin.h file - Device twin desired and reported properties over MQTT
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <az_iot_hub_client.h>
+
+#define TWIN_REPORTED_MAX 16       // distinct reported properties
+#define TWIN_TEXT_MAX 48           // longest string value reported
+#define TWIN_REPORT_WINDOW 2000    // ms updates are collected before a patch goes out
+#define TWIN_TOPIC_MAX 128
+
+// Called with the desired properties: the whole set when the twin is first
+// fetched (and again after a reconnect if it changed meanwhile), then each
+// patch as the cloud changes it. Values are only valid during the call.
+typedef void (*TwinDesiredHandler)(ArduinoJson::JsonObjectConst desired);
+
+// The device twin on the CloudLink connection. Desired properties are pushed
+// by the hub (no polling); reported properties are kept in a small table
+// and sent as minimal patches: only values that changed since they were
+// last reported, and every update within TWIN_REPORT_WINDOW of the first
+// one goes out in a single patch. After a reconnect the full twin is
+// fetched once, which also drops pending values the twin already holds.
+//
+// Reported property names must be string literals; "group.name" nests one
+// level ({"group": {"name": ...}}).
+// Network task only.
+class DeviceTwin {
+public:
+    DeviceTwin();
+
+    void onDesired(TwinDesiredHandler handler) { desiredHandler = handler; }
+
+    void report(const char* name, int32_t value);
+    void report(const char* name, float value);
+    void report(const char* name, bool value);
+    void report(const char* name, const char* value);
+
+    // From CloudLink: the connection is up and subscribed
+    void onConnected();
+
+    // From CloudLink: a message on one of the twin topics. The payload is
+    // NUL-terminated and may be modified.
+    void handleMessage(const az_iot_hub_client_twin_response& response, char* payload, size_t length);
+
+    // Sends the pending patch once its window has passed. Returns the delay
+    // in ms before it has to run again (UINT32_MAX when nothing is pending).
+    uint32_t step();
+
+    uint32_t getDesiredVersion() const { return desiredVersion; }
+    void printStatus();
+
+private:
+    enum ValueType : uint8_t { TWIN_INT, TWIN_FLOAT, TWIN_BOOL, TWIN_TEXT };
+    enum State : uint8_t { TWIN_REPORTED, TWIN_PENDING, TWIN_IN_FLIGHT };
+
+    struct Property {
+        const char* name;
+        ValueType type;
+        State state;
+        union {
+            int32_t i;
+            float f;
+            bool b;
+        } value;
+        char text[TWIN_TEXT_MAX];
+    };
+
+    Property properties[TWIN_REPORTED_MAX];
+    uint8_t propertyCount;
+    TwinDesiredHandler desiredHandler;
+    uint32_t desiredVersion;       // last desired version applied
+    uint32_t windowStart;          // millis() of the first pending update
+    bool windowOpen;
+    uint32_t nextRequestId;
+    uint32_t getRequestId;         // outstanding GET, 0 if none
+    uint32_t patchRequestId;       // outstanding reported patch, 0 if none
+    uint32_t requestSentMs;
+
+    Property* slot(const char* name, ValueType type, bool& created);
+    void markPending(Property& property);
+    bool sendPatch();
+    void requeueInFlight();
+    void applyDesired(ArduinoJson::JsonObjectConst desired, uint32_t version);
+    void dropReported(ArduinoJson::JsonObjectConst reported);
+    static bool matches(const Property& property, ArduinoJson::JsonVariantConst value);
+    static ArduinoJson::JsonVariantConst lookup(ArduinoJson::JsonObjectConst object, const char* name);
+};
+
+extern DeviceTwin deviceTwin;
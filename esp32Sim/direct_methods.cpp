@@ -0,0 +1,82 @@
+// direct_methods.cpp file - IoT Hub direct methods dispatched through a const table
+#include <esp_timer.h>
+
+#include "direct_methods.h"
+#include "cloud_link.h"
+#include "logger.h"
+#include "metrics.h"
+
+DirectMethodDispatcher directMethods;
+
+static Counter methodCalls("methods.calls");
+static Counter methodUnknown("methods.unknown");
+static Counter methodResponseFailures("methods.response_failures");
+static Histogram methodRoundTripUs("methods.round_trip_us");
+
+void DirectMethodDispatcher::handleRequest(const az_iot_hub_client_method_request& request, az_span payload,
+                                           int64_t receivedUs) {
+    methodCalls.inc();
+
+    char response[METHOD_RESPONSE_MAX] = "{}";
+    uint16_t status = 404;
+    const DirectMethod* method = nullptr;
+    for (size_t i = 0; i < methodCount; i++) {
+        if (az_span_is_content_equal(methods[i].name, request.name)) {
+            method = &methods[i];
+            break;
+        }
+    }
+    if (method != nullptr) {
+        status = method->handler(payload, response, sizeof(response));
+    } else {
+        methodUnknown.inc();
+        snprintf(response, sizeof(response), "{\"error\":\"unknown method\"}");
+    }
+
+    char topic[METHOD_TOPIC_MAX];
+    size_t topicLength;
+    if (az_result_failed(az_iot_hub_client_methods_response_get_publish_topic(
+            cloudLink.getHubClient(), request.request_id, status, topic, sizeof(topic), &topicLength)) ||
+        !cloudLink.publish(topic, response)) {
+        methodResponseFailures.inc();
+        return;
+    }
+
+    // Bytes arriving to the response leaving: wakeup, parse, handler, publish
+    methodRoundTripUs.record((uint32_t)(esp_timer_get_time() - receivedUs));
+    LOG_DEBUG("Direct method answered with %u", status);
+}
+
+void DirectMethodDispatcher::printStatus() {
+    Serial.printf("Direct methods: %u registered, %lu calls (%lu unknown)", (unsigned)methodCount,
+                  (unsigned long)methodCalls.get(), (unsigned long)methodUnknown.get());
+    if (methodRoundTripUs.getCount() > 0) {
+        Serial.printf(", round trip p50 %lu us, p99 %lu us", (unsigned long)methodRoundTripUs.percentile(0.5f),
+                      (unsigned long)methodRoundTripUs.percentile(0.99f));
+    }
+    Serial.println();
+}
+
+bool methodArgUint32(az_span payload, az_span name, uint32_t* value) {
+    az_json_reader reader;
+    if (az_result_failed(az_json_reader_init(&reader, payload, nullptr)) ||
+        az_result_failed(az_json_reader_next_token(&reader)) ||
+        reader.token.kind != AZ_JSON_TOKEN_BEGIN_OBJECT) {
+        return false;
+    }
+
+    while (az_result_succeeded(az_json_reader_next_token(&reader)) &&
+           reader.token.kind == AZ_JSON_TOKEN_PROPERTY_NAME) {
+        bool wanted = az_json_token_is_text_equal(&reader.token, name);
+        if (az_result_failed(az_json_reader_next_token(&reader))) {
+            return false;
+        }
+        if (wanted) {
+            return az_result_succeeded(az_json_token_get_uint32(&reader.token, value));
+        }
+        if (az_result_failed(az_json_reader_skip_children(&reader))) {
+            return false;
+        }
+    }
+    return false;
+}
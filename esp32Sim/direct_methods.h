@@ -0,0 +1,52 @@
+// direct_methods.h file - IoT Hub direct methods dispatched through a const table
+#pragma once
+
+#include <Arduino.h>
+#include <az_core.h>
+#include <az_iot_hub_client.h>
+
+#define METHOD_RESPONSE_MAX 256     // response JSON, built on the stack
+#define METHOD_TOPIC_MAX 96
+
+// Writes the response JSON into response (pre-filled with "{}") and returns
+// the status code sent back to the caller. payload views the request JSON
+// in the receive buffer; it is only valid during the call.
+typedef uint16_t (*DirectMethodHandler)(az_span payload, char* response, size_t responseSize);
+
+struct DirectMethod {
+    az_span name;                   // AZ_SPAN_LITERAL_FROM_STR("...")
+    DirectMethodHandler handler;
+};
+
+// Answers the direct methods arriving on the CloudLink connection. Nothing
+// is copied on the way in: the method name, request id and payload are
+// az_span views into the MQTT receive buffer, looked up in a const table
+// fixed at compile time, and arguments are read with az_json_reader
+// straight from the payload.
+// Network task only.
+class DirectMethodDispatcher {
+public:
+    DirectMethodDispatcher() : methods(nullptr), methodCount(0) {}
+
+    template <size_t N>
+    void setTable(const DirectMethod (&table)[N]) {
+        methods = table;
+        methodCount = N;
+    }
+
+    // From CloudLink: a request on the methods topic. receivedUs is when
+    // its bytes arrived (esp_timer time), for the round-trip histogram.
+    void handleRequest(const az_iot_hub_client_method_request& request, az_span payload, int64_t receivedUs);
+
+    void printStatus();
+
+private:
+    const DirectMethod* methods;
+    size_t methodCount;
+};
+
+// Reads a top-level unsigned number from a method payload in place.
+// False if the payload is not an object or the property is missing.
+bool methodArgUint32(az_span payload, az_span name, uint32_t* value);
+
+extern DirectMethodDispatcher directMethods;
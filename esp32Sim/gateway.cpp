@@ -0,0 +1,251 @@
+// gateway.cpp file - Child device identities sent over the gateway's connection
+#include "gateway.h"
+#include "azure_helper.h"
+
+#if AZURE_AUTH_X509 && GATEWAY_CHILD_COUNT > 0
+#error "Gateway children use keys derived from the enrollment group; set AZURE_AUTH_X509 to 0"
+#endif
+
+Gateway gateway;
+
+static Counter childRegistrations("gateway.child_registrations");
+static Counter childSent("gateway.child_sent");
+static Counter childFailed("gateway.child_failed");
+static Histogram burstMs("gateway.burst_ms");
+
+Gateway::Gateway() : childCount(0), assignedCount(0), nextChild(0), lastBurstRequests(0) {}
+
+void Gateway::begin() {
+    childCount = GATEWAY_CHILD_COUNT;
+    if (childCount == 0) {
+        return;
+    }
+
+    // The group key is decoded once for all children
+    DeviceKeyDeriver deriver;
+    bool keysReady = deriver.begin(AZURE_SYMMETRIC_KEY);
+    for (uint8_t i = 0; i < childCount; i++) {
+        GatewayChild& child = children[i];
+        snprintf(child.deviceId, sizeof(child.deviceId), GATEWAY_CHILD_ID_FORMAT, AZURE_DEVICE_ID, i + 1);
+        char deviceKey[DEVICE_KEY_BASE64_SIZE];
+        if (keysReady && deriver.derive(child.deviceId, deviceKey, sizeof(deviceKey))) {
+            child.deviceKey = deviceKey;
+        }
+        child.tokenHandle = -1;
+        child.sent = 0;
+        child.failed = 0;
+    }
+    LOG_INFO("Gateway mode: %u child devices, %lu keys derived", childCount, (unsigned long)deriver.getDerived());
+}
+
+bool Gateway::provisionStep() {
+    if (isProvisioned()) {
+        return true;
+    }
+    if (!dpsRetry.allowRequest()) {
+        return false;
+    }
+
+    HEAP_SCOPE(HEAP_DPS);
+    bool ok = true;
+    for (int requests = 0, scanned = 0; ok && requests < GATEWAY_DPS_REQUESTS_PER_STEP && scanned < childCount; scanned++) {
+        GatewayChild& child = children[nextChild];
+        nextChild = (nextChild + 1) % childCount;
+        if (child.hubHost.length() > 0 || child.deviceKey.length() == 0) {
+            continue;
+        }
+
+        ArenaScope scope(messageArena);
+        ok = child.operationId.length() == 0 ? registerChild(child) : pollChild(child);
+        requests++;
+    }
+    dpsConnection.close();
+
+    if (ok) {
+        dpsRetry.recordSuccess();
+    } else {
+        dpsRetry.recordFailure();
+    }
+    return isProvisioned();
+}
+
+bool Gateway::registerChild(GatewayChild& child) {
+    {
+        HEAP_SCOPE(HEAP_TOKEN);
+        azureSASTokenGenerator dpsTokenGen(AZURE_ID_SCOPE, child.deviceId, child.deviceKey);
+        child.dpsToken = dpsTokenGen.generateSASToken(time(NULL) + 3600);
+    }
+
+    const char* path = messageArena.printf("/%s/registrations/%s/register?api-version=2019-03-31",
+                                           AZURE_ID_SCOPE, child.deviceId);
+    const char* body = messageArena.printf("{\"registrationId\":\"%s\"}", child.deviceId);
+    if (path == nullptr || body == nullptr) {
+        return false;
+    }
+
+    HttpsRequest request(messageArena, "gateway.register", "PUT", AZURE_DPS_FQDN_ENDPOINT, path);
+    request.useConnection(dpsConnection);
+    request.addHeader("Authorization", child.dpsToken.c_str());
+    request.addHeader("Content-Type", "application/json");
+
+    int httpCode = request.send(body);
+    recordHttpStatus(httpCode);
+
+    ArduinoJson::JsonDocument doc(&messageArena);
+    if (httpCode != HTTP_CODE_ACCEPTED || deserializeJson(doc, request.getResponse(), request.getResponseLength())) {
+        LOG_WARN("Child %s registration failed with code: %d", child.deviceId, httpCode);
+        dpsFailures.inc();
+        return false;
+    }
+
+    child.operationId = doc["operationId"].as<String>();
+    LOG_DEBUG("Child %s registration initiated", child.deviceId);
+    return true;
+}
+
+bool Gateway::pollChild(GatewayChild& child) {
+    const char* path = messageArena.printf("/%s/registrations/%s/operations/%s?api-version=2019-03-31",
+                                           AZURE_ID_SCOPE, child.deviceId, child.operationId.c_str());
+    if (path == nullptr) {
+        return false;
+    }
+
+    HttpsRequest request(messageArena, "gateway.poll", "GET", AZURE_DPS_FQDN_ENDPOINT, path);
+    request.useConnection(dpsConnection);
+    request.addHeader("Authorization", child.dpsToken.c_str());
+
+    int httpCode = request.send();
+    recordHttpStatus(httpCode);
+
+    ArduinoJson::JsonDocument doc(&messageArena);
+    if (httpCode != HTTP_CODE_OK || deserializeJson(doc, request.getResponse(), request.getResponseLength())) {
+        LOG_WARN("Child %s status poll failed with code: %d", child.deviceId, httpCode);
+        return false;
+    }
+
+    const char* status = doc["status"] | "";
+    if (strcmp(status, "assigned") == 0) {
+        child.hubHost = doc["registrationState"]["assignedHub"] | "";
+        child.operationId = "";
+        child.dpsToken = "";
+        child.tokenHandle = sasTokenCache.add((child.hubHost + "/devices/" + child.deviceId).c_str(),
+                                              child.deviceKey.c_str());
+        assignedCount++;
+        childRegistrations.inc();
+        LOG_INFO("Child %s assigned to %s (%u/%u)", child.deviceId, child.hubHost, assignedCount, childCount);
+    } else if (strcmp(status, "failed") == 0) {
+        LOG_ERROR("Child %s provisioning failed", child.deviceId);
+        dpsFailures.inc();
+        child.operationId = ""; // registered again on a later step
+    }
+    return true;
+}
+
+void Gateway::sendTelemetry() {
+    if (assignedCount == 0 || !hubRetry.allowRequest()) {
+        return;
+    }
+
+    unsigned long burstStart = millis();
+    for (uint8_t i = 0; i < childCount; i++) {
+        GatewayChild& child = children[i];
+        if (child.tokenHandle < 0) {
+            continue;
+        }
+        // Children count against the same quota as the gateway
+        if (!hubLimiter.tryAcquire(1)) {
+            LOG_DEBUG("Rate limited; remaining children wait for the next cycle");
+            break;
+        }
+
+        ArenaScope scope(messageArena);
+        if (!sendChild(child)) {
+            break;  // the hub is unreachable; the rest would fail the same way
+        }
+    }
+    lastBurstRequests = hubConnection.getRequests();
+    hubConnection.close();
+    burstMs.record(millis() - burstStart);
+}
+
+// Returns false when the rest of the burst should be abandoned
+bool Gateway::sendChild(GatewayChild& child) {
+    // Borrowed from the cache; nothing below signs before send() returns
+    SasTokenView token;
+    if (!sasTokenCache.get(child.tokenHandle, token)) {
+        return true;
+    }
+
+    const char* payload = createChildPayload(child);
+    const char* path = messageArena.printf("/devices/%s/messages/events?api-version=2020-03-13", child.deviceId);
+    if (payload == nullptr || path == nullptr) {
+        LOG_ERROR("Child telemetry did not fit in the message arena");
+        return true;
+    }
+
+    HttpsRequest request(messageArena, "gateway.telemetry", "POST", child.hubHost.c_str(), path);
+    request.useConnection(hubConnection);
+    request.addHeader("Authorization", token.token);
+    request.addHeader("Content-Type", "application/json");
+    request.captureErrorsOnly();
+
+    int httpCode = request.send(payload);
+    recordHttpStatus(httpCode);
+
+    if (httpCode == HTTP_CODE_NO_CONTENT || httpCode == HTTP_CODE_OK) {
+        child.sent++;
+        childSent.inc();
+        hubRetry.recordSuccess();
+        hubLimiter.onAccepted();
+        return true;
+    }
+
+    LOG_WARN("Child %s telemetry failed with HTTP code: %d", child.deviceId, httpCode);
+    child.failed++;
+    childFailed.inc();
+    if (httpCode == 429 || httpCode == 503) {
+        telemetryThrottled.inc();
+        hubLimiter.onThrottled(request.getRetryAfterMs());
+        return false;
+    }
+    if (isRetryableStatus(httpCode)) {
+        hubRetry.recordFailure();
+        return false;
+    }
+    return true;  // a problem with this child only
+}
+
+// Simulated downstream sensor, like the gateway's own (see sensors.cpp)
+const char* Gateway::createChildPayload(const GatewayChild& child) {
+    HEAP_SCOPE(HEAP_PAYLOAD);
+    ArduinoJson::JsonDocument doc(&messageArena);
+
+    doc["deviceId"] = child.deviceId;
+    doc["gatewayId"] = AZURE_DEVICE_ID;
+    doc["storeId"] = STORE_ID;
+    doc["region"] = REGION;
+    doc["timestamp"] = time(NULL);
+    doc["temperature"] = 22.5 + (random(-50, 50) / 10.0);
+    doc["humidity"] = 45.0 + (random(-100, 100) / 10.0);
+    doc["batteryLevel"] = random(85, 100);
+
+    size_t length = measureJson(doc);
+    char* payload = (char*)messageArena.allocate(length + 1);
+    if (payload != nullptr) {
+        serializeJson(doc, payload, length + 1);
+    }
+    return payload;
+}
+
+void Gateway::printStatus() {
+    if (childCount == 0) {
+        return;
+    }
+    uint32_t sent = 0, failed = 0;
+    for (uint8_t i = 0; i < childCount; i++) {
+        sent += children[i].sent;
+        failed += children[i].failed;
+    }
+    Serial.printf("Gateway: %u/%u children assigned, %lu sent, %lu failed, last burst %lu requests on one connection\n",
+                  assignedCount, childCount, (unsigned long)sent, (unsigned long)failed, (unsigned long)lastBurstRequests);
+}
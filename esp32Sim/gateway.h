@@ -0,0 +1,70 @@
+// gateway.h file - Child device identities sent over the gateway's connection
+#pragma once
+
+#include <Arduino.h>
+
+#include "secret_configs.h"
+#include "https_request.h"
+
+// Downstream devices (e.g. sensors in the store) this device sends for;
+// override in secret_configs.h. 0 disables gateway mode.
+#ifndef GATEWAY_CHILD_COUNT
+#define GATEWAY_CHILD_COUNT 0
+#endif
+#define GATEWAY_MAX_CHILDREN 16
+#define GATEWAY_CHILD_ID_FORMAT "%s-child-%02u"  // gateway device id, child number
+#define GATEWAY_DPS_REQUESTS_PER_STEP 8           // registrations/polls per provisioning step
+
+static_assert(GATEWAY_CHILD_COUNT <= GATEWAY_MAX_CHILDREN, "GATEWAY_CHILD_COUNT is above GATEWAY_MAX_CHILDREN");
+
+struct GatewayChild {
+    char deviceId[64];
+    String deviceKey;       // derived from the enrollment group key
+    String operationId;     // DPS registration in flight
+    String hubHost;         // set once DPS has assigned the child
+    String dpsToken;        // while registering
+    int tokenHandle;        // hub token in sasTokenCache, once assigned
+    uint32_t sent;
+    uint32_t failed;
+};
+
+// Hosts GATEWAY_CHILD_COUNT logical device identities on this one physical
+// device. Every child is a regular device in the enrollment group, with a
+// key derived by deriveDeviceKey() and its own SAS tokens (from
+// sasTokenCache, so their renewals are spread out), but the
+// children's requests go out in bursts over one keep-alive connection per
+// endpoint: N children cost one TLS handshake per telemetry cycle, not N.
+// SAS authentication only. Network task only.
+class Gateway {
+public:
+    Gateway();
+
+    // Derives the child keys; call once the network task is running
+    void begin();
+
+    // Registers or polls up to GATEWAY_DPS_REQUESTS_PER_STEP children.
+    // Returns true once every child has a hub.
+    bool provisionStep();
+    bool isProvisioned() const { return assignedCount == childCount; }
+
+    // One message per assigned child, back to back on one connection
+    void sendTelemetry();
+
+    void printStatus();
+
+private:
+    GatewayChild children[GATEWAY_CHILD_COUNT > 0 ? GATEWAY_CHILD_COUNT : 1];
+    uint8_t childCount;
+    uint8_t assignedCount;
+    uint8_t nextChild;           // where the next provisioning step resumes
+    HttpsConnection dpsConnection;
+    HttpsConnection hubConnection;
+    uint32_t lastBurstRequests;
+
+    bool registerChild(GatewayChild& child);
+    bool pollChild(GatewayChild& child);
+    bool sendChild(GatewayChild& child);
+    const char* createChildPayload(const GatewayChild& child);
+};
+
+extern Gateway gateway;
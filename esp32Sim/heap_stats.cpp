@@ -0,0 +1,170 @@
+// heap_stats.cpp file - Heap and fragmentation instrumentation
+#include <esp_heap_caps.h>
+
+#include "heap_stats.h"
+#include "message_arena.h"
+#include "metrics.h"
+
+static const char* const tagNames[HEAP_TAG_COUNT] = {"other", "token", "payload", "http", "dps"};
+
+static HeapCounts tagCounts[HEAP_TAG_COUNT];
+static HeapSite sites[HEAP_SITE_COUNT];
+static uint8_t siteCount = 0;
+
+// Innermost open scope; read by the allocator hooks on any task
+static std::atomic<void*> scopeTask(nullptr);
+static std::atomic<uint8_t> scopeTag(HEAP_OTHER);
+static std::atomic<int8_t> scopeSite(-1);
+
+static Gauge minFreeHeap("heap.min_free_bytes");
+static Gauge largestFreeBlock("heap.largest_block_bytes");
+static Gauge fragmentation("heap.fragmentation_pct");
+
+static int8_t findSite(HeapTag tag, const char* file, int line) {
+    for (uint8_t i = 0; i < siteCount; i++) {
+        if (sites[i].line == line && sites[i].file == file) {
+            return i;
+        }
+    }
+    if (siteCount >= HEAP_SITE_COUNT) {
+        return -1;
+    }
+    sites[siteCount].file = file;
+    sites[siteCount].line = line;
+    sites[siteCount].tag = tag;
+    return siteCount++;
+}
+
+HeapScope::HeapScope(HeapTag tag, const char* file, int line)
+    : previousTag((HeapTag)scopeTag.load(std::memory_order_relaxed)),
+      previousSite(scopeSite.load(std::memory_order_relaxed)),
+      previousTask(scopeTask.load(std::memory_order_relaxed)),
+      site(findSite(tag, file, line)),
+      freeAtStart(heap_caps_get_free_size(MALLOC_CAP_8BIT)) {
+    tagCounts[tag].scopes.fetch_add(1, std::memory_order_relaxed);
+    if (site >= 0) {
+        sites[site].counts.scopes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    scopeTag.store(tag, std::memory_order_relaxed);
+    scopeSite.store(site, std::memory_order_relaxed);
+    scopeTask.store(xTaskGetCurrentTaskHandle(), std::memory_order_release);
+}
+
+HeapScope::~HeapScope() {
+    int32_t retained = (int32_t)freeAtStart - (int32_t)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    HeapTag tag = (HeapTag)scopeTag.load(std::memory_order_relaxed);
+    tagCounts[tag].retainedBytes.fetch_add(retained, std::memory_order_relaxed);
+    if (site >= 0) {
+        sites[site].counts.retainedBytes.fetch_add(retained, std::memory_order_relaxed);
+    }
+
+    scopeTask.store(previousTask, std::memory_order_relaxed);
+    scopeTag.store(previousTag, std::memory_order_relaxed);
+    scopeSite.store(previousSite, std::memory_order_release);
+}
+
+void heapRecordAllocation(size_t size) {
+    uint8_t tag = HEAP_OTHER;
+    int8_t site = -1;
+    if (scopeTask.load(std::memory_order_acquire) == xTaskGetCurrentTaskHandle()) {
+        tag = scopeTag.load(std::memory_order_relaxed);
+        site = scopeSite.load(std::memory_order_relaxed);
+    }
+
+    tagCounts[tag].allocations.fetch_add(1, std::memory_order_relaxed);
+    tagCounts[tag].bytes.fetch_add(size, std::memory_order_relaxed);
+    if (site >= 0) {
+        sites[site].counts.allocations.fetch_add(1, std::memory_order_relaxed);
+        sites[site].counts.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+void heapRecordFree() {
+    uint8_t tag = HEAP_OTHER;
+    if (scopeTask.load(std::memory_order_acquire) == xTaskGetCurrentTaskHandle()) {
+        tag = scopeTag.load(std::memory_order_relaxed);
+    }
+    tagCounts[tag].frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+// Invoked by the IDF heap on every allocation and free; must not allocate
+extern "C" void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps) {
+    heapRecordAllocation(size);
+}
+
+extern "C" void esp_heap_trace_free_hook(void* ptr) {
+    heapRecordFree();
+}
+#endif
+
+static uint32_t updateHeapGauges() {
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t largest = ESP.getMaxAllocHeap();
+    uint32_t fragmentationPct = freeHeap > 0 ? 100 - (uint32_t)((uint64_t)largest * 100 / freeHeap) : 0;
+
+    minFreeHeap.set(ESP.getMinFreeHeap());
+    largestFreeBlock.set(largest);
+    fragmentation.set(fragmentationPct);
+    return fragmentationPct;
+}
+
+void printHeapSummary() {
+    uint32_t fragmentationPct = updateHeapGauges();
+
+    Serial.printf("Min Free Heap: %u bytes, Largest Free Block: %u bytes (%u%% fragmented)\n",
+                  ESP.getMinFreeHeap(), ESP.getMaxAllocHeap(), (unsigned)fragmentationPct);
+    Serial.printf("Message Arena: %u/%u bytes high water (%lu failed allocations)\n",
+                  (unsigned)messageArena.getHighWater(), (unsigned)MESSAGE_ARENA_SIZE,
+                  (unsigned long)messageArena.getFailures());
+}
+
+static void printCounts(const char* label, const HeapCounts& counts) {
+    Serial.printf("  %-24s %8lu %8lu %10lu %8lu %10ld\n", label,
+                  (unsigned long)counts.scopes.load(std::memory_order_relaxed),
+                  (unsigned long)counts.allocations.load(std::memory_order_relaxed),
+                  (unsigned long)counts.bytes.load(std::memory_order_relaxed),
+                  (unsigned long)counts.frees.load(std::memory_order_relaxed),
+                  (long)counts.retainedBytes.load(std::memory_order_relaxed));
+}
+
+static const char* baseName(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+void printHeapStats() {
+    Serial.println("\n=== Heap ===");
+    Serial.printf("Free Heap: %u bytes\n", ESP.getFreeHeap());
+    printHeapSummary();
+
+#ifndef CONFIG_HEAP_USE_HOOKS
+    Serial.println("Allocation counts need CONFIG_HEAP_USE_HOOKS; showing net retained bytes only");
+#endif
+
+    Serial.printf("  %-24s %8s %8s %10s %8s %10s\n", "subsystem", "scopes", "allocs", "bytes", "frees", "retained");
+    for (uint8_t i = 0; i < HEAP_TAG_COUNT; i++) {
+        printCounts(tagNames[i], tagCounts[i]);
+    }
+
+    // Allocation sites, busiest first
+    Serial.printf("  %-24s %8s %8s %10s %8s %10s\n", "site", "scopes", "allocs", "bytes", "frees", "retained");
+    bool printed[HEAP_SITE_COUNT] = {};
+    for (uint8_t n = 0; n < siteCount; n++) {
+        int8_t best = -1;
+        for (uint8_t i = 0; i < siteCount; i++) {
+            if (printed[i]) continue;
+            if (best < 0 || sites[i].counts.bytes.load(std::memory_order_relaxed) >
+                                sites[best].counts.bytes.load(std::memory_order_relaxed)) {
+                best = i;
+            }
+        }
+        printed[best] = true;
+
+        char label[32];
+        snprintf(label, sizeof(label), "%s:%d", baseName(sites[best].file), sites[best].line);
+        printCounts(label, sites[best].counts);
+    }
+    Serial.println("============\n");
+}
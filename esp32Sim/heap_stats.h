@@ -0,0 +1,62 @@
+// heap_stats.h file - Heap and fragmentation instrumentation
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#define HEAP_SITE_COUNT 16  // distinct HEAP_SCOPE call sites tracked
+
+// Subsystems that allocation counts are attributed to
+enum HeapTag : uint8_t {
+    HEAP_OTHER,
+    HEAP_TOKEN,
+    HEAP_PAYLOAD,
+    HEAP_HTTP,
+    HEAP_DPS,
+    HEAP_TAG_COUNT
+};
+
+struct HeapCounts {
+    std::atomic<uint32_t> allocations;
+    std::atomic<uint32_t> frees;
+    std::atomic<uint32_t> bytes;
+    std::atomic<int32_t> retainedBytes;  // net free-heap drop across scopes
+    std::atomic<uint32_t> scopes;
+};
+
+struct HeapSite {
+    const char* file;
+    int line;
+    HeapTag tag;
+    HeapCounts counts;
+};
+
+// Attributes heap activity on the calling task to a subsystem until the
+// scope ends. Scopes nest; the innermost tag wins. The net change in free
+// heap across the scope is always recorded. Per-allocation counts need the
+// IDF heap hooks (CONFIG_HEAP_USE_HOOKS) and read zero without them.
+// Network task only.
+class HeapScope {
+public:
+    HeapScope(HeapTag tag, const char* file, int line);
+    ~HeapScope();
+
+private:
+    HeapTag previousTag;
+    int8_t previousSite;
+    void* previousTask;
+    int8_t site;
+    size_t freeAtStart;
+};
+
+#define HEAP_SCOPE(tag) HeapScope heapScope(tag, __FILE__, __LINE__)
+
+// Called from the allocator hooks; safe from any task
+void heapRecordAllocation(size_t size);
+void heapRecordFree();
+
+// Largest free block and low-water mark alongside the arena usage
+void printHeapSummary();
+
+// Per-subsystem counts and the allocation-site histogram (`heap` command)
+void printHeapStats();
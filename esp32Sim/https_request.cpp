@@ -0,0 +1,261 @@
+// https_request.cpp file - Phase-instrumented HTTPS request
+#include <WiFi.h>
+
+#include "https_request.h"
+#include "heap_stats.h"
+#include "tls_verify.h"
+#include "metrics.h"
+
+static Counter connectionsReused("https.connections_reused");
+
+bool httpReadLine(Client& client, char* buf, size_t size) {
+    size_t len = 0;
+    unsigned long lastByte = millis();
+
+    for (;;) {
+        int c = client.read();
+        if (c < 0) {
+            if (!client.connected() && !client.available()) return false;
+            if (millis() - lastByte > HTTPS_RESPONSE_TIMEOUT) return false;
+            delay(1);
+            continue;
+        }
+        lastByte = millis();
+        if (c == '\n') break;
+        if (c != '\r' && len + 1 < size) buf[len++] = (char)c;
+    }
+
+    buf[len] = '\0';
+    return true;
+}
+
+void HttpsConnection::close() {
+    client.stop();
+    host[0] = '\0';
+    requests = 0;
+}
+
+HttpsRequest::HttpsRequest(MessageArena& arena, const char* traceName, const char* method,
+                           const char* host, const char* path)
+    : arena(arena), traceName(traceName), method(method), host(host), path(path),
+      headers(nullptr), headersLength(0), head(nullptr), headLength(0), clientCertificate(nullptr),
+      clientKey(nullptr), response(nullptr),
+      responseLength(0), retryAfterMs(0), connection(nullptr), serverClosing(false), responseStarted(false), keepLimit(SIZE_MAX), errorsOnly(false), outOfMemory(false) {}
+
+void HttpsRequest::addHeader(const char* name, const char* value) {
+    char* line = arena.printf("%s: %s\r\n", name, value);
+    if (line == nullptr) {
+        outOfMemory = true;
+        return;
+    }
+    if (headers == nullptr) {
+        headers = line;
+        headersLength = strlen(line);
+    } else {
+        outOfMemory |= !arena.append(headers, headersLength, line, strlen(line));
+    }
+}
+
+int HttpsRequest::send(const uint8_t* body, size_t length) {
+    HEAP_SCOPE(HEAP_HTTP);
+    RequestTrace trace(traceName);
+    response = nullptr;
+    responseLength = 0;
+    retryAfterMs = 0;
+    serverClosing = false;
+    responseStarted = false;
+
+    if (head == nullptr && !outOfMemory) {
+        char contentLength[32] = "";
+        if (body != nullptr || strcmp(method, "GET") != 0) {
+            snprintf(contentLength, sizeof(contentLength), "Content-Length: %u\r\n", (unsigned)length);
+        }
+        head = arena.printf("%s %s HTTP/1.1\r\nHost: %s\r\n%sConnection: %s\r\n%s\r\n",
+                            method, path, host, headers ? headers : "",
+                            connection ? "keep-alive" : "close", contentLength);
+        headLength = head ? strlen(head) : 0;
+    }
+    if (head == nullptr) {
+        return trace.finish(HTTPC_ERROR_TOO_LESS_RAM);
+    }
+
+    TlsClient ownClient;
+    TlsClient& client = connection ? connection->client : ownClient;
+    bool reused = connection && connection->isOpenTo(host);
+    if (reused) {
+        // The DNS, TCP and TLS phases were paid for by an earlier request;
+        // left unmarked so they stay out of the handshake histograms
+        connectionsReused.inc();
+    } else {
+        if (connection) connection->close();
+        int error = open(client, trace);
+        if (error < 0) {
+            return trace.finish(error);
+        }
+        if (connection) snprintf(connection->host, sizeof(connection->host), "%s", host);
+    }
+
+    int status = HTTPC_ERROR_SEND_HEADER_FAILED;
+    if (client.write((const uint8_t*)head, headLength) == headLength) {
+        status = HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+        if (length == 0 || client.write(body, length) == length) {
+            trace.mark(PHASE_WRITE);
+            status = readResponse(client, trace);
+        }
+    }
+
+    if (connection == nullptr) {
+        client.stop();
+    } else if (status < 0 || serverClosing) {
+        connection->close();
+    } else {
+        connection->requests++;
+    }
+
+    // The server may have dropped an idle keep-alive connection before
+    // this request reached it; one retry on a fresh connection is safe.
+    // Once any of the response has arrived the request was processed, and
+    // sending it again would duplicate it.
+    if (reused && (status == HTTPC_ERROR_SEND_HEADER_FAILED ||
+                   (status == HTTPC_ERROR_CONNECTION_LOST && !responseStarted))) {
+        trace.finish(status);
+        return send(body, length);
+    }
+    return trace.finish(status);
+}
+
+int HttpsRequest::open(TlsClient& client, RequestTrace& trace) {
+    bool cachedPeer = tlsVerifier.configure(client, host);
+    if (clientCertificate != nullptr && clientKey != nullptr) {
+        client.setCertificate(clientCertificate);
+        client.setPrivateKey(clientKey);
+    }
+
+    IPAddress ip;
+    if (!WiFi.hostByName(host, ip)) {
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    trace.mark(PHASE_DNS);
+
+    // Connect in plain mode first so the TCP and TLS handshakes are timed
+    // separately; the resolved address is served from the lwIP DNS cache
+    client.setPlainStart();
+    if (!client.connect(host, HTTPS_PORT)) {
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    trace.mark(PHASE_CONNECT);
+
+    if (!client.startTLS()) {
+        client.stop();
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    trace.mark(PHASE_TLS);
+    if (!tlsVerifier.checkPeer(client, host, cachedPeer, trace.getPhaseUs(PHASE_TLS))) {
+        client.stop();
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+    return 0;
+}
+
+int HttpsRequest::readResponse(WiFiClientSecure& client, RequestTrace& trace) {
+    unsigned long waitStart = millis();
+    while (!client.available()) {
+        if (!client.connected()) return HTTPC_ERROR_CONNECTION_LOST;
+        if (millis() - waitStart > HTTPS_RESPONSE_TIMEOUT) return HTTPC_ERROR_READ_TIMEOUT;
+        delay(1);
+    }
+    responseStarted = true;
+    trace.mark(PHASE_WAIT);
+
+    char line[HTTPS_LINE_BUFFER];
+    if (!httpReadLine(client, line, sizeof(line)) || strncmp(line, "HTTP/1.", 7) != 0) {
+        return HTTPC_ERROR_NO_HTTP_SERVER;
+    }
+    int status = atoi(line + 9); // "HTTP/1.1 204 No Content"
+    serverClosing = strncmp(line, "HTTP/1.0", 8) == 0;
+
+    long contentLength = -1;
+    bool chunked = false;
+    for (;;) {
+        if (!httpReadLine(client, line, sizeof(line))) return HTTPC_ERROR_CONNECTION_LOST;
+        if (line[0] == '\0') break;
+
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            contentLength = atol(line + 15);
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line + 18, "chunked")) {
+            chunked = true;
+        } else if (strncasecmp(line, "Retry-After:", 12) == 0) {
+            // Delay-seconds form only; an HTTP-date parses as 0
+            retryAfterMs = (uint32_t)atol(line + 12) * 1000;
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strcasestr(line + 11, "close")) {
+            serverClosing = true;
+        }
+    }
+
+    // These never carry a body, whatever the headers say
+    if (status == 204 || status == 304 || status < 200 || strcmp(method, "HEAD") == 0) {
+        trace.mark(PHASE_READ);
+        return status;
+    }
+
+    // Without a length the body ends when the server closes the connection
+    if (contentLength < 0 && !chunked) {
+        serverClosing = true;
+    }
+
+    keepLimit = SIZE_MAX;
+    if (errorsOnly) {
+        keepLimit = (status >= 200 && status < 300) ? 0 : HTTPS_ERROR_BODY_MAX;
+    }
+    if (!readBody(client, contentLength, chunked)) {
+        return outOfMemory ? HTTPC_ERROR_TOO_LESS_RAM : HTTPC_ERROR_READ_TIMEOUT;
+    }
+    trace.mark(PHASE_READ);
+    return status;
+}
+
+bool HttpsRequest::readBody(WiFiClientSecure& client, long contentLength, bool chunked) {
+    char buf[128];  // scratch: bytes past keepLimit are read here and dropped
+
+    if (chunked) {
+        char line[HTTPS_LINE_BUFFER];
+        for (;;) {
+            if (!httpReadLine(client, line, sizeof(line))) return false;
+            long chunkLength = strtol(line, nullptr, 16);
+            if (chunkLength <= 0) {
+                httpReadLine(client, line, sizeof(line)); // trailing CRLF
+                return true;
+            }
+            if (!readBody(client, chunkLength, false)) return false;
+            if (!httpReadLine(client, line, sizeof(line))) return false; // CRLF after chunk data
+        }
+    }
+
+    // contentLength < 0 means read until the server closes the connection
+    long remaining = contentLength;
+    unsigned long lastData = millis();
+    while (remaining != 0) {
+        int avail = client.available();
+        if (avail <= 0) {
+            if (!client.connected()) return contentLength < 0;
+            if (millis() - lastData > HTTPS_RESPONSE_TIMEOUT) return false;
+            delay(1);
+            continue;
+        }
+
+        size_t want = sizeof(buf);
+        if (remaining > 0 && (size_t)remaining < want) want = remaining;
+        int n = client.read((uint8_t*)buf, want);
+        if (n <= 0) continue;
+
+        size_t keep = responseLength < keepLimit ? keepLimit - responseLength : 0;
+        if (keep > (size_t)n) keep = n;
+        if (keep > 0 && !arena.append(response, responseLength, buf, keep)) {
+            outOfMemory = true;
+            return false;
+        }
+        if (remaining > 0) remaining -= n;
+        lastData = millis();
+    }
+    return true;
+}
@@ -0,0 +1,118 @@
+// https_request.h file - Phase-instrumented HTTPS request
+#pragma once
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <WiFiClientSecure.h>
+
+#include "request_trace.h"
+#include "message_arena.h"
+#include "tls_client.h"
+
+#define HTTPS_PORT 443
+#define HTTPS_RESPONSE_TIMEOUT 5000  // ms to wait for the first response byte and between reads
+#define HTTPS_LINE_BUFFER 256        // longest status/header line kept; the rest is discarded
+#define HTTPS_ERROR_BODY_MAX 256     // error body bytes kept in errors-only mode
+#define HTTPS_HOST_MAX 128
+
+// Reads one line into buf without the CRLF, truncating overlong lines.
+// Returns false on timeout or when the connection closes first.
+bool httpReadLine(Client& client, char* buf, size_t size);
+
+// A TLS connection kept open across requests to one host (HTTP/1.1
+// keep-alive), so a burst of requests pays for a single handshake. Close it
+// when the burst is over; an idle connection holds the full TLS footprint.
+// Network task only.
+class HttpsConnection {
+public:
+    HttpsConnection() : requests(0) { host[0] = '\0'; }
+
+    bool isOpenTo(const char* name) { return host[0] && strcmp(host, name) == 0 && client.connected(); }
+    void close();
+
+    // Requests served by the current connection
+    uint32_t getRequests() const { return requests; }
+
+private:
+    friend class HttpsRequest;
+
+    TlsClient client;
+    char host[HTTPS_HOST_MAX];
+    uint32_t requests;
+};
+
+// A single HTTP/1.1 request, over a fresh TLS connection unless it is given
+// a shared HttpsConnection. Unlike HTTPClient the connection is driven step
+// by step (DNS, TCP, TLS, write, wait, read) so every phase can be
+// timestamped. Return values follow HTTPClient: the
+// HTTP status code, or a negative HTTPC_ERROR_* code.
+//
+// Headers and the response body are built in the caller's MessageArena;
+// host, path and header values must stay valid until send() returns.
+class HttpsRequest {
+public:
+    HttpsRequest(MessageArena& arena, const char* traceName, const char* method,
+                 const char* host, const char* path);
+
+    void addHeader(const char* name, const char* value);
+
+    // Authenticates with a TLS client certificate instead of a header
+    // (X.509 mode). Both PEM strings must outlive send().
+    void setClientCertificate(const char* certificatePem, const char* privateKeyPem) {
+        clientCertificate = certificatePem;
+        clientKey = privateKeyPem;
+    }
+
+    // Senders that only need the status code (telemetry) skip storing
+    // successful bodies: they are drained through a small scratch buffer,
+    // and only the first HTTPS_ERROR_BODY_MAX bytes of an error body are kept
+    void captureErrorsOnly() { errorsOnly = true; }
+
+    // Sends a complete, already serialized head (see PreparedRequest)
+    // instead of building one from addHeader(); it must carry its own
+    // Content-Length. The head has to outlive send().
+    void setHead(const char* preparedHead, size_t length) {
+        head = preparedHead;
+        headLength = length;
+    }
+
+    // Sends over a shared keep-alive connection instead of a fresh one;
+    // reconnects if it is closed or open to another host
+    void useConnection(HttpsConnection& shared) { connection = &shared; }
+
+    int send(const uint8_t* body = nullptr, size_t length = 0);
+    int send(const char* body) { return send((const uint8_t*)body, strlen(body)); }
+
+    // Valid until the arena is reset
+    const char* getResponse() const { return response ? response : ""; }
+    size_t getResponseLength() const { return responseLength; }
+
+    // Retry-After from the response in ms; 0 if absent or an HTTP-date
+    uint32_t getRetryAfterMs() const { return retryAfterMs; }
+
+private:
+    MessageArena& arena;
+    const char* traceName;
+    const char* method;
+    const char* host;
+    const char* path;
+    char* headers;
+    size_t headersLength;
+    const char* head;
+    size_t headLength;
+    const char* clientCertificate;
+    const char* clientKey;
+    char* response;
+    size_t responseLength;
+    uint32_t retryAfterMs;
+    HttpsConnection* connection;
+    bool serverClosing;      // "Connection: close", or a body delimited by the close
+    bool responseStarted;    // a response byte arrived, so the server took the request
+    size_t keepLimit;        // response bytes stored; the rest is drained
+    bool errorsOnly;
+    bool outOfMemory;
+
+    int open(TlsClient& client, RequestTrace& trace);
+    int readResponse(WiFiClientSecure& client, RequestTrace& trace);
+    bool readBody(WiFiClientSecure& client, long contentLength, bool chunked);
+};
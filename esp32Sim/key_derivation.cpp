@@ -0,0 +1,46 @@
+// key_derivation.cpp file - Device keys derived from an enrollment group key
+#include "key_derivation.h"
+#include "logger.h"
+
+DeviceKeyDeriver::DeviceKeyDeriver() : groupKeyLength(0), derived(0) {}
+
+DeviceKeyDeriver::~DeviceKeyDeriver() {
+    memset(groupKey, 0, sizeof(groupKey));
+}
+
+bool DeviceKeyDeriver::begin(const char* enrollmentGroupKey) {
+    groupKeyLength = 0;
+
+    // Decode the enrollment group key
+    size_t keyLength;
+    if (!getCryptoBackend().base64Decode(enrollmentGroupKey, strlen(enrollmentGroupKey),
+                                         groupKey, sizeof(groupKey), &keyLength)) {
+        LOG_ERROR("Failed to decode enrollment group key");
+        return false;
+    }
+
+    groupKeyLength = keyLength;
+    return true;
+}
+
+bool DeviceKeyDeriver::derive(const char* deviceId, char* out, size_t size) {
+    if (groupKeyLength == 0) {
+        return false;
+    }
+
+    CryptoBackend& crypto = getCryptoBackend();
+    uint8_t digest[CRYPTO_SHA256_SIZE];
+    if (!crypto.hmacSha256(groupKey, groupKeyLength, (const uint8_t*)deviceId, strlen(deviceId), digest)) {
+        LOG_ERROR("HMAC computation failed");
+        return false;
+    }
+
+    size_t encodedLength;
+    if (!crypto.base64Encode(digest, sizeof(digest), out, size, &encodedLength)) {
+        LOG_ERROR("Failed to encode device key");
+        return false;
+    }
+
+    derived++;
+    return true;
+}
@@ -0,0 +1,33 @@
+// key_derivation.h file - Device keys derived from an enrollment group key
+#pragma once
+
+#include <Arduino.h>
+
+#include "crypto_backend.h"
+
+#define DEVICE_KEY_BASE64_SIZE 45  // base64 of an HMAC-SHA256, plus the terminator
+
+// Derives the keys of any number of devices in one enrollment group
+// (base64(HMAC-SHA256(groupKey, deviceId)), as DPS expects). The group key
+// is decoded once in begin(); each derive() is then one HMAC through the
+// active CryptoBackend and a base64 encode.
+class DeviceKeyDeriver {
+public:
+    DeviceKeyDeriver();
+    ~DeviceKeyDeriver();
+
+    bool begin(const char* enrollmentGroupKey);
+
+    // Writes the base64 key to out (DEVICE_KEY_BASE64_SIZE bytes or more)
+    bool derive(const char* deviceId, char* out, size_t size);
+
+    uint32_t getDerived() const { return derived; }
+
+private:
+    uint8_t groupKey[64];
+    size_t groupKeyLength;
+    uint32_t derived;
+
+    DeviceKeyDeriver(const DeviceKeyDeriver&) = delete;
+    DeviceKeyDeriver& operator=(const DeviceKeyDeriver&) = delete;
+};
@@ -0,0 +1,170 @@
+// logger.cpp file - Leveled, deferred logging
+#include "logger.h"
+#include "metrics.h"
+#include "sensors.h"
+
+LogQueue logQueue;
+
+static TaskHandle_t logTaskHandle = nullptr;
+static Counter logDropped("log.dropped");
+
+static const char levelTags[] = {'-', 'E', 'W', 'I', 'D'};
+
+LogQueue::LogQueue() : enqueuePos(0), dequeuePos(0), dropped(0) {
+    for (uint32_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+        sequences[i].store(i, std::memory_order_relaxed);
+    }
+}
+
+LogRecord* LogQueue::claim() {
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        uint32_t index = pos & (LOG_QUEUE_SIZE - 1);
+        int32_t diff = (int32_t)(sequences[index].load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            // Slot is free for this position; race other producers for it
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return &records[index];
+            }
+        } else if (diff < 0) {
+            // The consumer has not freed this slot yet: queue is full
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            logDropped.inc();
+            return nullptr;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void LogQueue::publish(LogRecord* record) {
+    std::atomic<uint32_t>& sequence = sequences[record - records];
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool LogQueue::isBacklogged() const {
+    return enqueuePos.load(std::memory_order_relaxed) - dequeuePos.load(std::memory_order_relaxed) > LOG_QUEUE_SIZE / 2;
+}
+
+// Formats one record. Length modifiers in the format are ignored because
+// every argument was widened when it was captured.
+static size_t formatRecord(const LogRecord& record, char* line, size_t size) {
+    int used = snprintf(line, size, "[%lu %c] ", (unsigned long)record.timestampMs,
+                        levelTags[record.level < sizeof(levelTags) ? record.level : 0]);
+    size_t len = used > 0 ? used : 0;
+    uint8_t argIndex = 0;
+
+    for (const char* p = record.format; *p && len + 1 < size; p++) {
+        if (*p != '%') {
+            line[len++] = *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            line[len++] = '%';
+            p++;
+            continue;
+        }
+
+        // Collect flags, width and precision; drop length modifiers
+        char spec[16] = "%";
+        size_t specLen = 1;
+        p++;
+        while (*p && strchr("-+ #0123456789.", *p) && specLen < sizeof(spec) - 4) {
+            spec[specLen++] = *p++;
+        }
+        while (*p && strchr("hlLzjt", *p)) {
+            p++;
+        }
+        char conversion = *p;
+        if (!conversion) break;
+
+        int written = 0;
+        size_t room = size - len;
+        if (argIndex >= record.argCount) {
+            written = snprintf(line + len, room, "<?>");
+        } else if (strchr("diouxXc", conversion)) {
+            if (conversion == 'c') {
+                spec[specLen++] = 'c';
+                spec[specLen] = '\0';
+                written = snprintf(line + len, room, spec, (int)record.args[argIndex].i);
+            } else {
+                spec[specLen++] = 'l';
+                spec[specLen++] = 'l';
+                spec[specLen++] = conversion;
+                spec[specLen] = '\0';
+                if (conversion == 'd' || conversion == 'i') {
+                    written = snprintf(line + len, room, spec, (long long)record.args[argIndex].i);
+                } else {
+                    written = snprintf(line + len, room, spec, (unsigned long long)record.args[argIndex].i);
+                }
+            }
+        } else if (strchr("fFeEgGaA", conversion)) {
+            spec[specLen++] = conversion;
+            spec[specLen] = '\0';
+            double value = record.types[argIndex] == LogRecord::ARG_DOUBLE
+                               ? record.args[argIndex].d
+                               : (double)record.args[argIndex].i;
+            written = snprintf(line + len, room, spec, value);
+        } else if (conversion == 's') {
+            spec[specLen++] = 's';
+            spec[specLen] = '\0';
+            uint8_t offset = record.args[argIndex].textOffset;
+            const char* text = record.types[argIndex] == LogRecord::ARG_STRING && offset < LOG_TEXT_BYTES
+                                   ? record.text + offset
+                                   : "";
+            written = snprintf(line + len, room, spec, text);
+        } else if (conversion == 'p') {
+            written = snprintf(line + len, room, "%p", (void*)(uintptr_t)record.args[argIndex].i);
+        }
+        argIndex++;
+
+        if (written > 0) {
+            len += ((size_t)written < room) ? (size_t)written : room - 1;
+        }
+    }
+
+    if (len >= size) len = size - 1;
+    line[len] = '\0';
+    return len;
+}
+
+void LogQueue::drain(Print& out) {
+    char line[LOG_LINE_BYTES];
+
+    for (;;) {
+        uint32_t pos = dequeuePos.load(std::memory_order_relaxed);
+        uint32_t index = pos & (LOG_QUEUE_SIZE - 1);
+        int32_t diff = (int32_t)(sequences[index].load(std::memory_order_acquire) - (pos + 1));
+        if (diff < 0) {
+            return; // empty, or the producer has not published this slot yet
+        }
+
+        size_t len = formatRecord(records[index], line, sizeof(line));
+        sequences[index].store(pos + LOG_QUEUE_SIZE, std::memory_order_release);
+        dequeuePos.store(pos + 1, std::memory_order_relaxed);
+
+        out.write((const uint8_t*)line, len);
+        out.write((const uint8_t*)"\r\n", 2);
+    }
+}
+
+static void logTask(void* param) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_DRAIN_INTERVAL));
+        logQueue.drain(Serial);
+    }
+}
+
+void logNotify() {
+    if (logTaskHandle) {
+        xTaskNotifyGive(logTaskHandle);
+    }
+}
+
+void startLogger() {
+    if (logTaskHandle) {
+        return;
+    }
+    xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK, nullptr,
+                            LOG_TASK_PRIORITY, &logTaskHandle, NETWORK_CORE);
+}
@@ -0,0 +1,168 @@
+// logger.h file - Leveled, deferred logging
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Override in secret_configs.h; calls above this level compile to nothing
+// and their arguments are never evaluated
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_QUEUE_SIZE 32        // records in flight (power of two)
+#define LOG_MAX_ARGS 6
+#define LOG_TEXT_BYTES 64        // shared storage for copied string arguments
+#define LOG_LINE_BYTES 256       // longest formatted line
+#define LOG_DRAIN_INTERVAL 100   // ms between drains when the queue is quiet
+#define LOG_TASK_PRIORITY 1      // below the network task: UART I/O only uses idle time
+#define LOG_TASK_STACK 3072
+
+// One log call captured by value. The format string must be a literal; it is
+// only stored by pointer and formatted later on the drain task.
+struct LogRecord {
+    enum ArgType : uint8_t { ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_STRING };
+
+    uint32_t timestampMs;
+    const char* format;
+    uint8_t level;
+    uint8_t argCount;
+    uint8_t textUsed;
+    ArgType types[LOG_MAX_ARGS];
+    union {
+        int64_t i;
+        double d;
+        uint8_t textOffset;
+    } args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_BYTES];
+
+    void addInt(int64_t value, bool isSigned) {
+        if (argCount >= LOG_MAX_ARGS) return;
+        types[argCount] = isSigned ? ARG_INT : ARG_UINT;
+        args[argCount++].i = value;
+    }
+
+    void addDouble(double value) {
+        if (argCount >= LOG_MAX_ARGS) return;
+        types[argCount] = ARG_DOUBLE;
+        args[argCount++].d = value;
+    }
+
+    // Copies the string, truncating once the shared text storage is full
+    void addString(const char* value) {
+        if (argCount >= LOG_MAX_ARGS) return;
+        types[argCount] = ARG_STRING;
+        args[argCount++].textOffset = textUsed;
+        if (textUsed >= LOG_TEXT_BYTES) return;
+
+        size_t room = LOG_TEXT_BYTES - textUsed - 1;
+        size_t len = value ? strnlen(value, room) : 0;
+        if (len) memcpy(text + textUsed, value, len);
+        text[textUsed + len] = '\0';
+        textUsed += len + 1;
+    }
+};
+
+// Argument capture, picked by type at compile time
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+logCaptureArg(LogRecord& record, T value) {
+    record.addInt((int64_t)value, std::is_signed<T>::value);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+logCaptureArg(LogRecord& record, T value) {
+    record.addDouble(value);
+}
+
+inline void logCaptureArg(LogRecord& record, const char* value) { record.addString(value); }
+inline void logCaptureArg(LogRecord& record, char* value) { record.addString(value); }
+inline void logCaptureArg(LogRecord& record, const String& value) { record.addString(value.c_str()); }
+
+template <typename T>
+inline void logCaptureArg(LogRecord& record, T* value) {
+    record.addInt((int64_t)(uintptr_t)value, false);
+}
+
+// Multi-producer/single-consumer bounded queue (per-slot sequence numbers),
+// so any task on either core can log without a lock
+class LogQueue {
+public:
+    LogQueue();
+
+    // Producer: claims a slot, or returns nullptr (and counts a drop) if full
+    LogRecord* claim();
+    void publish(LogRecord* record);
+
+    // Consumer: formats and writes everything queued so far
+    void drain(Print& out);
+
+    uint32_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+    bool isBacklogged() const;
+
+private:
+    std::atomic<uint32_t> sequences[LOG_QUEUE_SIZE];
+    LogRecord records[LOG_QUEUE_SIZE];
+    std::atomic<uint32_t> enqueuePos;
+    std::atomic<uint32_t> dequeuePos;  // written by the consumer only
+    std::atomic<uint32_t> dropped;
+};
+
+extern LogQueue logQueue;
+
+// Wakes the drain task early, e.g. when the queue is filling up
+void logNotify();
+
+template <typename... Args>
+inline void logWrite(uint8_t level, const char* format, const Args&... args) {
+    LogRecord* record = logQueue.claim();
+    if (!record) return;
+
+    record->timestampMs = millis();
+    record->format = format;
+    record->level = level;
+    record->argCount = 0;
+    record->textUsed = 0;
+    int expand[] = {0, (logCaptureArg(*record, args), 0)...};
+    (void)expand;
+    logQueue.publish(record);
+
+    if (level == LOG_LEVEL_ERROR || logQueue.isBacklogged()) {
+        logNotify();
+    }
+}
+
+// Starts the low-priority task that formats and prints queued records
+void startLogger();
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) logWrite(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) logWrite(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) logWrite(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) logWrite(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) do {} while (0)
+#endif
@@ -0,0 +1,126 @@
+// message_arena.cpp file - Per-message bump allocator
+#include "message_arena.h"
+#include "metrics.h"
+
+// Each block is preceded by its size so reallocate() can copy it
+#define ARENA_HEADER_SIZE MESSAGE_ARENA_ALIGN
+
+MessageArena messageArena;
+
+static Gauge arenaHighWater("arena.high_water_bytes");
+static Counter arenaFailures("arena.failures");
+
+static size_t alignUp(size_t size) {
+    return (size + MESSAGE_ARENA_ALIGN - 1) & ~(size_t)(MESSAGE_ARENA_ALIGN - 1);
+}
+
+MessageArena::MessageArena() : used(0), highWater(0), lastBlock(nullptr), failures(0) {}
+
+size_t MessageArena::blockSize(const void* ptr) {
+    return *(const size_t*)((const uint8_t*)ptr - ARENA_HEADER_SIZE);
+}
+
+void* MessageArena::allocate(size_t size) {
+    size_t needed = ARENA_HEADER_SIZE + alignUp(size);
+    if (needed > MESSAGE_ARENA_SIZE - used) {
+        failures++;
+        arenaFailures.inc();
+        return nullptr;
+    }
+
+    uint8_t* block = buffer + used + ARENA_HEADER_SIZE;
+    *(size_t*)(block - ARENA_HEADER_SIZE) = size;
+    used += needed;
+    lastBlock = block;
+
+    if (used > highWater) {
+        highWater = used;
+        arenaHighWater.set(highWater);
+    }
+    return block;
+}
+
+void MessageArena::deallocate(void* ptr) {
+    // Only the most recent block can be handed back; the rest go on reset()
+    if (ptr != nullptr && ptr == lastBlock) {
+        used = (uint8_t*)ptr - ARENA_HEADER_SIZE - buffer;
+        lastBlock = nullptr;
+    }
+}
+
+void* MessageArena::reallocate(void* ptr, size_t newSize) {
+    if (ptr == nullptr) {
+        return allocate(newSize);
+    }
+
+    // Grow or shrink in place when nothing was allocated after this block
+    if (ptr == lastBlock) {
+        size_t start = (uint8_t*)ptr - buffer;
+        size_t needed = alignUp(newSize);
+        if (needed > MESSAGE_ARENA_SIZE - start) {
+            failures++;
+            arenaFailures.inc();
+            return nullptr;
+        }
+        *(size_t*)((uint8_t*)ptr - ARENA_HEADER_SIZE) = newSize;
+        used = start + needed;
+        if (used > highWater) {
+            highWater = used;
+            arenaHighWater.set(highWater);
+        }
+        return ptr;
+    }
+
+    void* block = allocate(newSize);
+    if (block != nullptr) {
+        size_t oldSize = blockSize(ptr);
+        memcpy(block, ptr, oldSize < newSize ? oldSize : newSize);
+    }
+    return block;
+}
+
+char* MessageArena::strdup(const char* str) {
+    size_t len = strlen(str);
+    char* copy = (char*)allocate(len + 1);
+    if (copy != nullptr) {
+        memcpy(copy, str, len + 1);
+    }
+    return copy;
+}
+
+char* MessageArena::printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(nullptr, 0, format, args);
+    va_end(args);
+    if (len < 0) {
+        return nullptr;
+    }
+
+    char* str = (char*)allocate(len + 1);
+    if (str == nullptr) {
+        return nullptr;
+    }
+
+    va_start(args, format);
+    vsnprintf(str, len + 1, format, args);
+    va_end(args);
+    return str;
+}
+
+bool MessageArena::append(char*& str, size_t& length, const char* data, size_t dataLength) {
+    char* grown = (char*)reallocate(str, length + dataLength + 1);
+    if (grown == nullptr) {
+        return false;
+    }
+    memcpy(grown + length, data, dataLength);
+    length += dataLength;
+    grown[length] = '\0';
+    str = grown;
+    return true;
+}
+
+void MessageArena::reset() {
+    used = 0;
+    lastBlock = nullptr;
+}
@@ -0,0 +1,57 @@
+// message_arena.h file - Per-message bump allocator
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define MESSAGE_ARENA_SIZE 6144  // URL, headers, JSON document, payload and response of one message
+#define MESSAGE_ARENA_ALIGN 8
+
+// Bump allocator over a static buffer for everything built while sending
+// one message. Nothing is freed individually; reset() releases it all at
+// once, so per-message strings never touch (or fragment) the heap. Also
+// usable as the ArduinoJson allocator so documents live in the arena too.
+// Network task only.
+class MessageArena : public ArduinoJson::Allocator {
+public:
+    MessageArena();
+
+    // ArduinoJson::Allocator
+    void* allocate(size_t size) override;
+    void deallocate(void* ptr) override;
+    void* reallocate(void* ptr, size_t newSize) override;
+
+    char* strdup(const char* str);
+    char* printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    // Appends to a string previously allocated here; grows in place when it
+    // is the most recent allocation. Returns false when the arena is full.
+    bool append(char*& str, size_t& length, const char* data, size_t dataLength);
+
+    void reset();
+
+    size_t getUsed() const { return used; }
+    size_t getHighWater() const { return highWater; }
+    uint32_t getFailures() const { return failures; }
+
+private:
+    alignas(MESSAGE_ARENA_ALIGN) uint8_t buffer[MESSAGE_ARENA_SIZE];
+    size_t used;
+    size_t highWater;
+    uint8_t* lastBlock;
+    uint32_t failures;
+
+    static size_t blockSize(const void* ptr);
+};
+
+// Resets the arena when the message that used it goes out of scope
+class ArenaScope {
+public:
+    explicit ArenaScope(MessageArena& arena) : arena(arena) {}
+    ~ArenaScope() { arena.reset(); }
+
+private:
+    MessageArena& arena;
+};
+
+extern MessageArena messageArena;
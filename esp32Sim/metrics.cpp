@@ -0,0 +1,168 @@
+// metrics.cpp file - Runtime metrics registry
+#include "metrics.h"
+
+#define HISTOGRAM_SUB_BITS 2      // log2(HISTOGRAM_SUB_BUCKETS)
+
+Metric* Metric::head = nullptr;
+
+// Application metrics
+Counter telemetrySent("telemetry.sent");
+Counter telemetryFailed("telemetry.failed");
+Counter telemetryThrottled("telemetry.throttled");
+Counter tokenRefreshes("token.refreshes");
+Counter tokenRefreshFailures("token.refresh_failures");
+Counter dpsRegistrations("dps.registrations");
+Counter dpsFailures("dps.failures");
+Histogram telemetrySendMs("telemetry.send_ms");
+Histogram provisioningMs("dps.provision_ms");
+Gauge freeHeapBytes("heap.free_bytes");
+Gauge wifiRssi("wifi.rssi_dbm");
+
+static Counter http2xx("http.2xx");
+static Counter http4xx("http.4xx");
+static Counter http429("http.429");
+static Counter http5xx("http.5xx");
+static Counter httpOther("http.other");
+static Counter httpTransportErrors("http.transport_errors");
+
+// Registration happens during static initialization, before any task runs
+Metric::Metric(const char* name, Type type) : name(name), type(type), next(head) {
+    head = this;
+}
+
+Histogram::Histogram(const char* name) : Metric(name, HISTOGRAM), count(0), sum(0), maxValue(0) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+int Histogram::bucketFor(uint32_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    int msb = 31 - __builtin_clz(value);
+    int sub = (value >> (msb - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    int bucket = (msb - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+uint32_t Histogram::bucketUpperBound(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int msb = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    int sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    uint32_t lower = (uint32_t)(HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return lower + ((1u << shift) - 1);
+}
+
+void Histogram::record(uint32_t value) {
+    buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint32_t current = maxValue.load(std::memory_order_relaxed);
+    while (value > current &&
+           !maxValue.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint32_t Histogram::getMean() const {
+    uint32_t n = getCount();
+    return n ? sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint32_t Histogram::percentile(float p) const {
+    uint32_t n = getCount();
+    if (n == 0) {
+        return 0;
+    }
+
+    uint32_t rank = (uint32_t)(p * n + 0.5f);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+
+    uint32_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            uint32_t upper = bucketUpperBound(i);
+            uint32_t max = getMax();
+            return upper < max ? upper : max;
+        }
+    }
+    return getMax();
+}
+
+void recordHttpStatus(int httpCode) {
+    if (httpCode < 0) {
+        httpTransportErrors.inc();
+    } else if (httpCode >= 200 && httpCode < 300) {
+        http2xx.inc();
+    } else if (httpCode == 429) {
+        http429.inc();
+    } else if (httpCode >= 400 && httpCode < 500) {
+        http4xx.inc();
+    } else if (httpCode >= 500) {
+        http5xx.inc();
+    } else {
+        httpOther.inc();
+    }
+}
+
+void printMetrics() {
+    Serial.println("\n=== Metrics ===");
+    for (Metric* m = Metric::first(); m; m = m->getNext()) {
+        switch (m->getType()) {
+            case Metric::COUNTER:
+                Serial.printf("%-28s %lu\n", m->getName(), (unsigned long)static_cast<Counter*>(m)->get());
+                break;
+            case Metric::GAUGE:
+                Serial.printf("%-28s %ld\n", m->getName(), (long)static_cast<Gauge*>(m)->get());
+                break;
+            case Metric::HISTOGRAM: {
+                Histogram* h = static_cast<Histogram*>(m);
+                Serial.printf("%-28s n=%lu mean=%lu p50=%lu p90=%lu p99=%lu max=%lu\n", m->getName(),
+                              (unsigned long)h->getCount(), (unsigned long)h->getMean(),
+                              (unsigned long)h->percentile(0.50f), (unsigned long)h->percentile(0.90f),
+                              (unsigned long)h->percentile(0.99f), (unsigned long)h->getMax());
+                break;
+            }
+        }
+    }
+    Serial.println("===============\n");
+}
+
+void printMetricsSummary() {
+    Serial.printf("Telemetry: %lu sent, %lu throttled, %lu failed (send p50 %lu ms, p99 %lu ms)\n",
+                  (unsigned long)telemetrySent.get(), (unsigned long)telemetryThrottled.get(),
+                  (unsigned long)telemetryFailed.get(),
+                  (unsigned long)telemetrySendMs.percentile(0.50f),
+                  (unsigned long)telemetrySendMs.percentile(0.99f));
+    Serial.printf("Token Refreshes: %lu (%lu failed)\n",
+                  (unsigned long)tokenRefreshes.get(), (unsigned long)tokenRefreshFailures.get());
+}
+
+void addMetricsToJson(JsonObject obj) {
+    for (Metric* m = Metric::first(); m; m = m->getNext()) {
+        switch (m->getType()) {
+            case Metric::COUNTER:
+                obj[m->getName()] = static_cast<Counter*>(m)->get();
+                break;
+            case Metric::GAUGE:
+                obj[m->getName()] = static_cast<Gauge*>(m)->get();
+                break;
+            case Metric::HISTOGRAM: {
+                Histogram* h = static_cast<Histogram*>(m);
+                if (h->getCount() == 0) break;
+                JsonObject hist = obj[m->getName()].to<JsonObject>();
+                hist["n"] = h->getCount();
+                hist["p50"] = h->percentile(0.50f);
+                hist["p99"] = h->percentile(0.99f);
+                hist["max"] = h->getMax();
+                break;
+            }
+        }
+    }
+}
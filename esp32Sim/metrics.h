@@ -0,0 +1,101 @@
+// metrics.h file - Runtime metrics registry
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+
+#define HISTOGRAM_SUB_BUCKETS 4   // buckets per power of two (~19% relative error)
+#define HISTOGRAM_BUCKETS 96      // covers values up to 2^25 - 1 before clamping
+
+// Every metric links itself into a global list on construction, so metrics
+// are declared as globals next to the code that updates them and show up in
+// the registry without any central table. All updates are single relaxed
+// atomic operations and safe from any task or core.
+class Metric {
+public:
+    enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+    Metric(const char* name, Type type);
+
+    const char* getName() const { return name; }
+    Type getType() const { return type; }
+    Metric* getNext() const { return next; }
+
+    static Metric* first() { return head; }
+
+private:
+    const char* name;
+    Type type;
+    Metric* next;
+    static Metric* head;
+};
+
+class Counter : public Metric {
+public:
+    explicit Counter(const char* name) : Metric(name, COUNTER), value(0) {}
+
+    void inc(uint32_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint32_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint32_t> value;
+};
+
+class Gauge : public Metric {
+public:
+    explicit Gauge(const char* name) : Metric(name, GAUGE), value(0) {}
+
+    void set(int32_t v) { value.store(v, std::memory_order_relaxed); }
+    void add(int32_t delta) { value.fetch_add(delta, std::memory_order_relaxed); }
+    int32_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int32_t> value;
+};
+
+// Log-bucketed histogram: each power of two is split into
+// HISTOGRAM_SUB_BUCKETS linear buckets. Percentiles report the upper bound
+// of the bucket containing the requested rank.
+class Histogram : public Metric {
+public:
+    explicit Histogram(const char* name);
+
+    void record(uint32_t value);
+
+    uint32_t getCount() const { return count.load(std::memory_order_relaxed); }
+    uint32_t getMax() const { return maxValue.load(std::memory_order_relaxed); }
+    uint32_t getMean() const;
+    uint32_t percentile(float p) const;
+
+    static int bucketFor(uint32_t value);
+    static uint32_t bucketUpperBound(int bucket);
+
+private:
+    std::atomic<uint32_t> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> sum;        // wraps on very long uptimes; mean is approximate
+    std::atomic<uint32_t> maxValue;
+};
+
+// Application metrics
+extern Counter telemetrySent;
+extern Counter telemetryFailed;
+extern Counter telemetryThrottled;  // 429/503 from the hub; also counted as failed
+extern Counter tokenRefreshes;
+extern Counter tokenRefreshFailures;
+extern Counter dpsRegistrations;
+extern Counter dpsFailures;
+extern Histogram telemetrySendMs;
+extern Histogram provisioningMs;
+extern Gauge freeHeapBytes;
+extern Gauge wifiRssi;
+
+// Buckets HTTP results by status class; negative codes are transport errors
+void recordHttpStatus(int httpCode);
+
+void printMetrics();
+void printMetricsSummary();
+
+// Compact diagnostics object for the telemetry payload
+void addMetricsToJson(JsonObject obj);
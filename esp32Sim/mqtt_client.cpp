@@ -0,0 +1,356 @@
+// mqtt_client.cpp file - Minimal event-driven MQTT 3.1.1 client over TLS
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+
+#include "mqtt_client.h"
+#include "tls_verify.h"
+#include "sensors.h"
+#include "logger.h"
+#include "metrics.h"
+
+#define MQTT_PING_TIMEOUT 10000  // ms without a PINGRESP before the link counts as dead
+
+// Control packet types (high nibble of the fixed header)
+enum MqttPacketType {
+    MQTT_CONNECT = 1,
+    MQTT_CONNACK = 2,
+    MQTT_PUBLISH = 3,
+    MQTT_PUBACK = 4,
+    MQTT_SUBSCRIBE = 8,
+    MQTT_SUBACK = 9,
+    MQTT_PINGREQ = 12,
+    MQTT_PINGRESP = 13,
+    MQTT_DISCONNECT = 14
+};
+
+static Counter mqttConnects("mqtt.connects");
+static Counter mqttConnectFailures("mqtt.connect_failures");
+static Counter mqttPings("mqtt.pings");
+static Counter mqttOversize("mqtt.oversize_dropped");
+
+// Remaining Length: 7 bits per byte, least significant first
+static size_t encodeLength(uint8_t* out, size_t length) {
+    size_t used = 0;
+    do {
+        uint8_t digit = length & 0x7F;
+        length >>= 7;
+        out[used++] = length > 0 ? (digit | 0x80) : digit;
+    } while (length > 0);
+    return used;
+}
+
+static void putString(uint8_t*& p, const char* value, size_t length) {
+    *p++ = length >> 8;
+    *p++ = length & 0xFF;
+    memcpy(p, value, length);
+    p += length;
+}
+
+MqttClient::MqttClient()
+    : clientCertificate(nullptr), clientKey(nullptr), messageCallback(nullptr), dataCallback(nullptr),
+      isOpen(false), nextPacketId(1), lastSendMs(0), pingSentMs(0), watchTask(nullptr),
+      watchedSocket(-1), dataReadyUs(0) {}
+
+bool MqttClient::connect(const char* host, const char* clientId, const char* username, const char* password) {
+    disconnect();
+
+    bool cachedPeer = tlsVerifier.configure(client, host);
+    if (clientCertificate != nullptr && clientKey != nullptr) {
+        client.setCertificate(clientCertificate);
+        client.setPrivateKey(clientKey);
+    }
+
+    client.setPlainStart();
+    if (!client.connect(host, MQTT_PORT)) {
+        mqttConnectFailures.inc();
+        return false;
+    }
+    int64_t handshakeStart = esp_timer_get_time();
+    if (!client.startTLS() ||
+        !tlsVerifier.checkPeer(client, host, cachedPeer, (uint32_t)(esp_timer_get_time() - handshakeStart))) {
+        client.stop();
+        mqttConnectFailures.inc();
+        return false;
+    }
+
+    size_t clientIdLength = strlen(clientId);
+    size_t usernameLength = strlen(username);
+    size_t passwordLength = password ? strlen(password) : 0;
+    size_t remaining = 10 + 2 + clientIdLength + 2 + usernameLength + (password ? 2 + passwordLength : 0);
+    if (remaining + 5 > sizeof(tx)) {
+        LOG_ERROR("MQTT CONNECT does not fit in %u bytes", MQTT_TX_BUFFER);
+        client.stop();
+        mqttConnectFailures.inc();
+        return false;
+    }
+
+    uint8_t* p = tx;
+    *p++ = MQTT_CONNECT << 4;
+    p += encodeLength(p, remaining);
+    putString(p, "MQTT", 4);
+    *p++ = 4;                                    // protocol level 3.1.1
+    *p++ = 0x80 | (password ? 0x40 : 0);         // username, password; clean session off
+    *p++ = MQTT_KEEPALIVE_SECONDS >> 8;
+    *p++ = MQTT_KEEPALIVE_SECONDS & 0xFF;
+    putString(p, clientId, clientIdLength);
+    putString(p, username, usernameLength);
+    if (password) {
+        putString(p, password, passwordLength);
+    }
+
+    isOpen = true;
+    if (!writePacket(tx, p - tx) || !waitFor(MQTT_CONNACK)) {
+        disconnect();
+        mqttConnectFailures.inc();
+        return false;
+    }
+    if (packet[1] != 0) {
+        // 4: bad user name or password (e.g. an expired token), 5: not authorized
+        LOG_ERROR("MQTT connection refused, return code %u", packet[1]);
+        disconnect();
+        mqttConnectFailures.inc();
+        return false;
+    }
+
+    // Messages queued while offline arrive with the SUBACK; time them from here
+    dataReadyUs.store(esp_timer_get_time(), std::memory_order_relaxed);
+    watchedSocket.store(client.getSocket());
+    if (watchTask == nullptr) {
+        xTaskCreatePinnedToCore(watchLoop, "mqtt-watch", MQTT_WATCH_STACK, this,
+                                MQTT_WATCH_PRIORITY, &watchTask, NETWORK_CORE);
+    }
+    mqttConnects.inc();
+    return true;
+}
+
+bool MqttClient::subscribe(const char* topic, uint8_t qos) {
+    uint16_t packetId = nextPacketId++;
+    if (nextPacketId == 0) nextPacketId = 1;
+
+    size_t topicLength = strlen(topic);
+    size_t remaining = 2 + 2 + topicLength + 1;
+    if (remaining + 5 > sizeof(tx)) {
+        return false;
+    }
+
+    uint8_t* p = tx;
+    *p++ = (MQTT_SUBSCRIBE << 4) | 0x02;
+    p += encodeLength(p, remaining);
+    *p++ = packetId >> 8;
+    *p++ = packetId & 0xFF;
+    putString(p, topic, topicLength);
+    *p++ = qos;
+
+    // SUBACK: packet id, then the granted QoS or 0x80 for a failure
+    return writePacket(tx, p - tx) && waitFor(MQTT_SUBACK) && packet[2] != 0x80;
+}
+
+bool MqttClient::publish(const char* topic, const uint8_t* payload, size_t length) {
+    size_t topicLength = strlen(topic);
+    size_t remaining = 2 + topicLength + length;
+
+    uint8_t* p = tx;
+    *p++ = MQTT_PUBLISH << 4;
+    p += encodeLength(p, remaining);
+    if ((size_t)(p - tx) + 2 + topicLength > sizeof(tx)) {
+        return false;
+    }
+    putString(p, topic, topicLength);
+
+    // One TLS record when header and payload fit together
+    if ((size_t)(p - tx) + length <= sizeof(tx)) {
+        memcpy(p, payload, length);
+        return writePacket(tx, (p - tx) + length);
+    }
+    return writePacket(tx, p - tx) && writePacket(payload, length);
+}
+
+bool MqttClient::loop() {
+    if (!connected()) {
+        disconnect();
+        return false;
+    }
+
+    while (client.available() > 0) {
+        if (readPacket() < 0) {
+            disconnect();
+            return false;
+        }
+    }
+
+    uint32_t now = millis();
+    if (pingSentMs != 0 && now - pingSentMs > MQTT_PING_TIMEOUT) {
+        LOG_WARN("MQTT broker stopped answering pings");
+        disconnect();
+        return false;
+    }
+    if (pingSentMs == 0 && now - lastSendMs >= MQTT_KEEPALIVE_SECONDS * 1000UL / 2) {
+        uint8_t ping[2] = {MQTT_PINGREQ << 4, 0};
+        if (!writePacket(ping, sizeof(ping))) {
+            disconnect();
+            return false;
+        }
+        pingSentMs = now | 1;
+        mqttPings.inc();
+    }
+
+    // Everything received so far is consumed; wait for the next bytes
+    if (watchTask != nullptr) {
+        xTaskNotifyGive(watchTask);
+    }
+    return true;
+}
+
+uint32_t MqttClient::getKeepAliveDueMs() const {
+    uint32_t now = millis();
+    if (pingSentMs != 0) {
+        uint32_t waited = now - pingSentMs;
+        return waited >= MQTT_PING_TIMEOUT ? 0 : MQTT_PING_TIMEOUT - waited;
+    }
+    uint32_t quiet = now - lastSendMs;
+    uint32_t interval = MQTT_KEEPALIVE_SECONDS * 1000UL / 2;
+    return quiet >= interval ? 0 : interval - quiet;
+}
+
+void MqttClient::disconnect() {
+    watchedSocket.store(-1);
+    if (isOpen && client.connected()) {
+        uint8_t bye[2] = {MQTT_DISCONNECT << 4, 0};
+        client.write(bye, sizeof(bye));
+    }
+    client.stop();
+    isOpen = false;
+    pingSentMs = 0;
+}
+
+bool MqttClient::readBytes(uint8_t* buf, size_t length) {
+    size_t received = 0;
+    unsigned long lastByte = millis();
+    while (received < length) {
+        int n = client.read(buf + received, length - received);
+        if (n > 0) {
+            received += n;
+            lastByte = millis();
+            continue;
+        }
+        if (!client.connected()) return false;
+        if (millis() - lastByte > MQTT_READ_TIMEOUT) return false;
+        delay(1);
+    }
+    return true;
+}
+
+// Reads one packet into packet[] and handles it. Returns its type, or -1
+// if the connection failed partway through.
+int MqttClient::readPacket() {
+    uint8_t header;
+    if (!readBytes(&header, 1)) return -1;
+
+    size_t length = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t digit;
+        if (shift > 21 || !readBytes(&digit, 1)) return -1;
+        length |= (size_t)(digit & 0x7F) << shift;
+        if (!(digit & 0x80)) break;
+    }
+
+    size_t kept = length < MQTT_PACKET_MAX ? length : MQTT_PACKET_MAX;
+    if (!readBytes(packet, kept)) return -1;
+    for (size_t rest = length - kept; rest > 0;) {
+        uint8_t scratch[64];
+        size_t n = rest < sizeof(scratch) ? rest : sizeof(scratch);
+        if (!readBytes(scratch, n)) return -1;
+        rest -= n;
+    }
+
+    int type = header >> 4;
+    if (type == MQTT_PUBLISH) {
+        handlePublish(header, kept, kept < length);
+    } else if (type == MQTT_PINGRESP) {
+        pingSentMs = 0;
+    }
+    return type;
+}
+
+bool MqttClient::waitFor(int type) {
+    unsigned long start = millis();
+    while (millis() - start < MQTT_READ_TIMEOUT) {
+        if (client.available() > 0) {
+            int received = readPacket();
+            if (received < 0) return false;
+            if (received == type) return true;
+        } else if (!client.connected()) {
+            return false;
+        } else {
+            delay(1);
+        }
+    }
+    return false;
+}
+
+void MqttClient::handlePublish(uint8_t header, size_t length, bool truncated) {
+    uint8_t qos = (header >> 1) & 0x03;
+    if (length < 2) return;
+
+    size_t topicLength = ((size_t)packet[0] << 8) | packet[1];
+    size_t offset = 2 + topicLength;
+    uint16_t packetId = 0;
+    if (qos > 0) {
+        if (offset + 2 > length) return;
+        packetId = ((uint16_t)packet[offset] << 8) | packet[offset + 1];
+        offset += 2;
+    }
+    if (offset > length) return;
+
+    bool acknowledge = true;
+    if (truncated) {
+        // Acknowledged anyway: it would only be redelivered at the same size
+        LOG_WARN("MQTT message over %u bytes dropped", MQTT_PACKET_MAX);
+        mqttOversize.inc();
+    } else if (messageCallback != nullptr) {
+        packet[length] = '\0';
+        MqttMessage message = {(const char*)packet + 2, topicLength, (char*)packet + offset, length - offset, qos};
+        acknowledge = messageCallback(message);
+    }
+
+    if (qos == 1 && acknowledge) {
+        uint8_t puback[4] = {MQTT_PUBACK << 4, 2, (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xFF)};
+        writePacket(puback, sizeof(puback));
+    }
+}
+
+bool MqttClient::writePacket(const uint8_t* data, size_t length) {
+    if (client.write(data, length) != length) {
+        return false;
+    }
+    lastSendMs = millis();
+    return true;
+}
+
+// Watcher task: sleeps in select() until the socket turns readable, reports
+// it once, then waits for loop() to re-arm it
+void MqttClient::watchLoop(void* param) {
+    MqttClient* self = (MqttClient*)param;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        for (;;) {
+            int fd = self->watchedSocket.load();
+            if (fd < 0) break;
+
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(fd, &readable);
+            // The timeout only bounds how long a socket closed under us is watched
+            struct timeval timeout = {1, 0};
+            if (select(fd + 1, &readable, nullptr, nullptr, &timeout) != 0) {
+                // Readable, closed or failed: in each case loop() has to look
+                self->dataReadyUs.store(esp_timer_get_time(), std::memory_order_relaxed);
+                if (self->dataCallback != nullptr) {
+                    self->dataCallback();
+                }
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,111 @@
+// mqtt_client.h file - Minimal event-driven MQTT 3.1.1 client over TLS
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "secret_configs.h"
+#include "tls_client.h"
+
+#define MQTT_PORT 8883
+#define MQTT_PACKET_MAX 2048        // largest incoming packet kept; longer ones are drained and dropped
+#define MQTT_TX_BUFFER 512          // CONNECT and SUBSCRIBE packets, publish headers
+#define MQTT_READ_TIMEOUT 5000      // ms to wait for the rest of a packet once it has started
+#define MQTT_WATCH_STACK 2048
+#define MQTT_WATCH_PRIORITY 3       // above the network task, so arrival times are taken promptly
+
+// Keep-alive agreed with the broker; override in secret_configs.h.
+// IoT Hub drops a connection after 1.5x this long without a packet.
+#ifndef MQTT_KEEPALIVE_SECONDS
+#define MQTT_KEEPALIVE_SECONDS 240
+#endif
+
+// An incoming PUBLISH, valid only during the callback. The topic is not
+// NUL-terminated; the payload is (in place, one byte past its end), so JSON
+// can be parsed straight out of the receive buffer.
+struct MqttMessage {
+    const char* topic;
+    size_t topicLength;
+    char* payload;
+    size_t payloadLength;
+    uint8_t qos;
+};
+
+// Returning false leaves a QoS 1 message unacknowledged
+typedef bool (*MqttMessageCallback)(const MqttMessage& message);
+
+// Just enough MQTT for IoT Hub's device endpoint: CONNECT, SUBSCRIBE,
+// QoS 0 publishes out and QoS 0/1 publishes in, with keep-alive pings.
+//
+// Nothing polls for incoming data. A small watcher task blocks in select()
+// on the socket and calls the onData() callback when bytes arrive, which
+// should schedule loop() on the network task (TaskScheduler::runNow); the
+// watcher is re-armed once loop() has drained everything.
+// Network task only, apart from the onData() callback.
+class MqttClient {
+public:
+    MqttClient();
+
+    void onMessage(MqttMessageCallback callback) { messageCallback = callback; }
+
+    // Runs on the watcher task; must be safe to call from another task
+    void onData(void (*callback)()) { dataCallback = callback; }
+
+    // Authenticates with a TLS client certificate (X.509 mode). Both PEM
+    // strings must outlive the connection.
+    void setClientCertificate(const char* certificatePem, const char* privateKeyPem) {
+        clientCertificate = certificatePem;
+        clientKey = privateKeyPem;
+    }
+
+    // Opens the TLS connection and waits for the CONNACK. A null password
+    // leaves it out (certificate authentication). The session is kept by
+    // the broker, so QoS 1 messages that were not acknowledged are
+    // delivered again after a reconnect.
+    bool connect(const char* host, const char* clientId, const char* username, const char* password);
+
+    // Waits for the SUBACK; messages arriving meanwhile are dispatched
+    bool subscribe(const char* topic, uint8_t qos);
+
+    // QoS 0
+    bool publish(const char* topic, const uint8_t* payload, size_t length);
+    bool publish(const char* topic, const char* payload) { return publish(topic, (const uint8_t*)payload, strlen(payload)); }
+
+    // Dispatches every packet received so far and pings the broker when the
+    // link has been quiet. Returns false once the connection is gone.
+    bool loop();
+
+    // ms until loop() has to run for the keep-alive
+    uint32_t getKeepAliveDueMs() const;
+
+    // esp_timer time at which the watcher saw the data loop() is
+    // dispatching arrive
+    int64_t getDataReadyUs() const { return dataReadyUs.load(std::memory_order_relaxed); }
+
+    bool connected() { return isOpen && client.connected(); }
+    void disconnect();
+
+private:
+    TlsClient client;
+    const char* clientCertificate;
+    const char* clientKey;
+    MqttMessageCallback messageCallback;
+    void (*dataCallback)();
+    bool isOpen;
+    uint16_t nextPacketId;
+    uint32_t lastSendMs;
+    uint32_t pingSentMs;         // 0 when no PINGRESP is outstanding
+    uint8_t packet[MQTT_PACKET_MAX + 1];  // + the payload's NUL
+    uint8_t tx[MQTT_TX_BUFFER];
+
+    TaskHandle_t watchTask;
+    std::atomic<int> watchedSocket;
+    std::atomic<int64_t> dataReadyUs;
+
+    bool readBytes(uint8_t* buf, size_t length);
+    int readPacket();
+    bool waitFor(int type);
+    void handlePublish(uint8_t header, size_t length, bool truncated);
+    bool writePacket(const uint8_t* data, size_t length);
+    static void watchLoop(void* param);
+};
@@ -0,0 +1,411 @@
+// ota_update.cpp file - Streaming OTA firmware update
+#include <Update.h>
+
+#include "ota_update.h"
+#include "https_request.h"
+#include "logger.h"
+#include "metrics.h"
+#include "tls_verify.h"
+
+OtaUpdater otaUpdater;
+
+static Counter otaCompleted("ota.completed");
+static Counter otaFailed("ota.failed");
+static Counter otaResumes("ota.resumes");
+static Counter otaBytesDownloaded("ota.bytes_downloaded");
+static Counter otaBytesImage("ota.bytes_image");
+static Gauge otaProgress("ota.progress_pct");
+
+// Shared by every chunk; kept off the network task stack
+static uint8_t chunk[OTA_CHUNK_SIZE];
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+OtaUpdater::OtaUpdater()
+    : state(OTA_IDLE), statusCallback(nullptr), port(0), secure(true), delta(false), client(nullptr),
+      received(0), imageBytes(0), total(0), remaining(-1), retries(0), lastProgress(0), lastData(0) {
+    host[0] = '\0';
+    path[0] = '\0';
+    version[0] = '\0';
+    mbedtls_sha256_init(&sha);
+}
+
+bool OtaUpdater::parseUrl(const char* url) {
+    if (strncmp(url, "https://", 8) == 0) {
+        secure = true;
+        port = 443;
+        url += 8;
+    } else if (strncmp(url, "http://", 7) == 0) {
+        secure = false;
+        port = 80;
+        url += 7;
+    } else {
+        return false;
+    }
+
+    const char* slash = strchr(url, '/');
+    const char* hostEnd = slash ? slash : url + strlen(url);
+    const char* colon = (const char*)memchr(url, ':', hostEnd - url);
+    size_t hostLength = (colon ? colon : hostEnd) - url;
+    if (hostLength == 0 || hostLength >= sizeof(host)) {
+        return false;
+    }
+    memcpy(host, url, hostLength);
+    host[hostLength] = '\0';
+
+    if (colon) {
+        port = (uint16_t)atoi(colon + 1);
+    }
+    snprintf(path, sizeof(path), "%s", slash ? slash : "/");
+    return port != 0 && strlen(slash ? slash : "/") < sizeof(path);
+}
+
+bool OtaUpdater::start(const char* url, const char* sha256Hex, const char* targetVersion, bool useDelta) {
+    if (isActive()) {
+        LOG_WARN("OTA update already in progress");
+        return false;
+    }
+    if (!parseUrl(url)) {
+        LOG_ERROR("Invalid OTA URL: %s", url);
+        return false;
+    }
+    if (strlen(sha256Hex) != 64) {
+        LOG_ERROR("OTA SHA-256 must be 64 hex digits");
+        return false;
+    }
+    for (int i = 0; i < 32; i++) {
+        int high = hexValue(sha256Hex[i * 2]);
+        int low = hexValue(sha256Hex[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            LOG_ERROR("OTA SHA-256 must be 64 hex digits");
+            return false;
+        }
+        expectedHash[i] = (uint8_t)(high << 4 | low);
+    }
+    snprintf(version, sizeof(version), "%s", targetVersion ? targetVersion : "");
+    delta = useDelta;
+
+    client = secure ? (Client*)&secureClient : (Client*)&plainClient;
+    if (secure) {
+#if TLS_VERIFY_MODE == TLS_VERIFY_NONE
+        secureClient.setInsecure();
+#else
+        // One long download per attempt, so the handshake cost hardly
+        // matters: validate the full chain every time
+        secureClient.setCACert(azureRootCertificates);
+#endif
+    }
+
+    received = 0;
+    total = 0;
+    retries = 0;
+    lastProgress = 0;
+    otaProgress.set(0);
+    state = OTA_CONNECTING;
+
+    LOG_INFO("OTA update requested: version %s", version);
+    LOG_INFO("Downloading firmware %s from %s:%u%s", delta ? "patch" : "image", host, port, path);
+    report("downloading");
+    return true;
+}
+
+void OtaUpdater::abort(const char* reason) {
+    if (isActive()) {
+        fail(reason);
+    }
+}
+
+uint32_t OtaUpdater::step() {
+    switch (state) {
+        case OTA_CONNECTING:
+            if (!openConnection()) {
+                return state == OTA_FAILED ? 0 : retry("connection failed");
+            }
+            state = OTA_DOWNLOADING;
+            return 1;
+        case OTA_DOWNLOADING:
+            return download();
+        default:
+            return 0;
+    }
+}
+
+// Starts the image over: used for the first response and when a server
+// answers a Range request with the whole file
+bool OtaUpdater::restartImage() {
+    if (Update.isRunning()) {
+        Update.abort();
+    }
+    mbedtls_sha256_free(&sha);
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    received = 0;
+    imageBytes = 0;
+    lastProgress = 0;
+
+    // A patch only knows the image size once its header has arrived
+    if (delta) {
+        patcher.reset(this);
+        return true;
+    }
+    if (!beginImage(total)) {
+        fail(Update.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool OtaUpdater::beginImage(size_t targetSize) {
+    return Update.begin(targetSize > 0 ? targetSize : UPDATE_SIZE_UNKNOWN);
+}
+
+bool OtaUpdater::writeImage(const uint8_t* data, size_t length) {
+    mbedtls_sha256_update(&sha, data, length);
+    if (Update.write((uint8_t*)data, length) != length) {
+        return false;
+    }
+    imageBytes += length;
+    return true;
+}
+
+bool OtaUpdater::openConnection() {
+    client->stop();
+    if (!client->connect(host, port)) {
+        return false;
+    }
+
+    char request[HTTPS_LINE_BUFFER * 2];
+    int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n", path, host);
+    if (received > 0) {
+        length += snprintf(request + length, sizeof(request) - length, "Range: bytes=%u-\r\n", (unsigned)received);
+    }
+    length += snprintf(request + length, sizeof(request) - length, "\r\n");
+    if (length >= (int)sizeof(request) || client->write((const uint8_t*)request, length) != (size_t)length) {
+        client->stop();
+        return false;
+    }
+
+    char line[HTTPS_LINE_BUFFER];
+    if (!httpReadLine(*client, line, sizeof(line)) || strncmp(line, "HTTP/1.", 7) != 0) {
+        client->stop();
+        return false;
+    }
+    int status = atoi(line + 9);
+
+    long contentLength = -1;
+    long rangeStart = -1;
+    long rangeTotal = -1;
+    for (;;) {
+        if (!httpReadLine(*client, line, sizeof(line))) {
+            client->stop();
+            return false;
+        }
+        if (line[0] == '\0') break;
+
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            contentLength = atol(line + 15);
+        } else if (strncasecmp(line, "Content-Range:", 14) == 0) {
+            // "Content-Range: bytes 4096-1048575/1048576"
+            const char* bytes = strstr(line + 14, "bytes ");
+            const char* slash = strchr(line, '/');
+            if (bytes) rangeStart = atol(bytes + 6);
+            if (slash && slash[1] != '*') rangeTotal = atol(slash + 1);
+        }
+    }
+
+    if (status == 206 && received > 0 && rangeStart == (long)received) {
+        if (rangeTotal > 0) total = rangeTotal;
+        otaResumes.inc();
+        LOG_INFO("OTA resuming at byte %u", (unsigned)received);
+    } else if (status == 200) {
+        if (received > 0) {
+            LOG_WARN("OTA server ignored the Range request; restarting download");
+        }
+        total = contentLength > 0 ? contentLength : 0;
+        if (!restartImage()) {
+            client->stop();
+            return false;
+        }
+    } else if (status == 206) {
+        // Not the range we asked for: start over without one
+        LOG_WARN("OTA server returned an unexpected range; restarting download");
+        received = 0;
+        client->stop();
+        return false;
+    } else {
+        LOG_ERROR("OTA download failed with code: %d", status);
+        client->stop();
+        // Retrying will not help a client error such as 404
+        if (status >= 400 && status < 500) {
+            fail("download rejected");
+        }
+        return false;
+    }
+
+    remaining = contentLength;
+    lastData = millis();
+    return true;
+}
+
+uint32_t OtaUpdater::download() {
+    unsigned long stepStart = millis();
+
+    while (millis() - stepStart < OTA_STEP_BUDGET_MS) {
+        // The running image is hashed a slice per step before any op is
+        // read; the download waits in the socket meanwhile
+        if (delta && patcher.isVerifyingSource()) {
+            if (!patcher.verifySource(OTA_STEP_BUDGET_MS - (millis() - stepStart))) {
+                return fail(patcher.getError());
+            }
+            lastData = millis();
+            continue;
+        }
+
+        if (remaining == 0 || (total > 0 && received >= total)) {
+            return finish();
+        }
+
+        int avail = client->available();
+        if (avail <= 0) {
+            if (!client->connected()) {
+                // Read-until-close responses end here; anything else was cut off
+                if (remaining < 0 && total == 0) {
+                    return finish();
+                }
+                return retry("connection lost");
+            }
+            if (millis() - lastData > HTTPS_RESPONSE_TIMEOUT) {
+                return retry("read timeout");
+            }
+            // Let the rest of the scheduler run while the next segment arrives
+            return 10;
+        }
+
+        size_t want = sizeof(chunk);
+        if (remaining > 0 && (size_t)remaining < want) want = remaining;
+        if (delta && patcher.getHeaderRemaining() > 0 && patcher.getHeaderRemaining() < want) {
+            want = patcher.getHeaderRemaining();
+        }
+        int n = client->read(chunk, want);
+        if (n <= 0) {
+            continue;
+        }
+
+        if (delta) {
+            if (!patcher.write(chunk, n)) {
+                return fail(Update.hasError() ? Update.errorString() : patcher.getError());
+            }
+        } else if (!writeImage(chunk, n)) {
+            return fail(Update.errorString());
+        }
+        received += n;
+        if (remaining > 0) remaining -= n;
+        lastData = millis();
+        retries = 0;
+
+        if (total > 0) {
+            uint8_t percent = (uint8_t)((uint64_t)received * 100 / total);
+            otaProgress.set(percent);
+            if (percent >= lastProgress + OTA_PROGRESS_STEP) {
+                lastProgress = percent - percent % OTA_PROGRESS_STEP;
+                LOG_INFO("OTA progress: %u/%u bytes (%u%%)", (unsigned)received, (unsigned)total, percent);
+            }
+        }
+    }
+    return 1;
+}
+
+uint32_t OtaUpdater::retry(const char* reason) {
+    client->stop();
+    if (++retries > OTA_MAX_RETRIES) {
+        return fail(reason);
+    }
+
+    uint32_t delayMs = (uint32_t)OTA_RETRY_DELAY << (retries - 1);
+    LOG_WARN("OTA %s at byte %u, retry %u/%u in %lu ms", reason, (unsigned)received,
+             retries, OTA_MAX_RETRIES, (unsigned long)delayMs);
+    state = OTA_CONNECTING;
+    return delayMs;
+}
+
+uint32_t OtaUpdater::finish() {
+    client->stop();
+    if (delta && !patcher.isComplete()) {
+        return fail("patch ended early");
+    }
+
+    uint8_t hash[32];
+    mbedtls_sha256_finish(&sha, hash);
+    mbedtls_sha256_free(&sha);
+    if (memcmp(hash, expectedHash, sizeof(hash)) != 0) {
+        return fail("SHA-256 mismatch");
+    }
+
+    report("installing");
+    if (!Update.end(true)) {
+        return fail(Update.errorString());
+    }
+
+    state = OTA_DONE;
+    otaCompleted.inc();
+    otaBytesDownloaded.inc(received);
+    otaBytesImage.inc(imageBytes);
+    otaProgress.set(100);
+    LOG_INFO("OTA update to %s verified (%u bytes)", version, (unsigned)imageBytes);
+    if (delta) {
+        LOG_INFO("OTA delta: downloaded %u bytes for a %u byte image (%u%% saved)",
+                 (unsigned)received, (unsigned)imageBytes,
+                 imageBytes > 0 ? (unsigned)(100 - (uint64_t)received * 100 / imageBytes) : 0);
+    }
+    report("completed");
+    return 0;
+}
+
+uint32_t OtaUpdater::fail(const char* reason) {
+    if (client) {
+        client->stop();
+    }
+    if (Update.isRunning()) {
+        Update.abort();
+    }
+    mbedtls_sha256_free(&sha);
+
+    state = OTA_FAILED;
+    otaFailed.inc();
+    LOG_ERROR("OTA update failed: %s", reason);
+    report("failed", reason);
+    return 0;
+}
+
+void OtaUpdater::report(const char* status, const char* error) {
+    if (statusCallback) {
+        statusCallback(status, version, error);
+    }
+}
+
+void OtaUpdater::printStatus() {
+    static const char* const stateNames[] = {"idle", "connecting", "downloading", "done", "failed"};
+
+    Serial.printf("OTA: %s", stateNames[state]);
+    if (state != OTA_IDLE) {
+        Serial.printf(", version %s, %u", version, (unsigned)received);
+        if (total > 0) {
+            Serial.printf("/%u bytes (%u%%)", (unsigned)total, (unsigned)((uint64_t)received * 100 / total));
+        } else {
+            Serial.print(" bytes");
+        }
+        if (delta) {
+            // What the same update costs as a full image
+            Serial.printf(", delta: %u image bytes written", (unsigned)imageBytes);
+            if (patcher.getTargetSize() > 0) {
+                Serial.printf(" of %u", (unsigned)patcher.getTargetSize());
+            }
+        }
+    }
+    Serial.println();
+}
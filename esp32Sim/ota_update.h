@@ -0,0 +1,99 @@
+// ota_update.h file - Streaming OTA firmware update
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+#include <mbedtls/sha256.h>
+
+#include "delta_patch.h"
+#include "tls_client.h"
+
+#define OTA_CHUNK_SIZE 4096        // bytes read and written to flash per step
+#define OTA_STEP_BUDGET_MS 200     // longest a single step may hold the network task
+#define OTA_MAX_RETRIES 5          // reconnects (with Range resume) before giving up
+#define OTA_RETRY_DELAY 2000       // first reconnect delay, doubled on each retry
+#define OTA_PROGRESS_STEP 10       // percent between progress reports
+
+enum OtaState {
+    OTA_IDLE,
+    OTA_CONNECTING,
+    OTA_DOWNLOADING,
+    OTA_DONE,
+    OTA_FAILED
+};
+
+// Reports "downloading", "installing", "completed" or "failed", mirroring the
+// firmwareStatus messages of the Node simulator
+typedef void (*OtaStatusCallback)(const char* status, const char* version, const char* error);
+
+// Downloads a firmware image straight into the inactive app partition.
+// The image is never buffered: each chunk is hashed (SHA-256) and written to
+// flash as it arrives. A dropped connection is resumed with an HTTP Range
+// request from the last byte written. Work is done in short steps so the
+// scheduler keeps serving telemetry during a download. http:// URLs are
+// accepted as well, e.g. for a local file server on the LAN.
+//
+// In delta mode the download is a patch against the running image (see
+// DeltaPatcher); it is applied as it streams in and the SHA-256 is checked
+// against the reconstructed image, not the patch.
+// Network task only.
+class OtaUpdater : private DeltaSink {
+public:
+    OtaUpdater();
+
+    void onStatus(OtaStatusCallback callback) { statusCallback = callback; }
+
+    // sha256Hex is the expected digest of the whole image (64 hex digits)
+    bool start(const char* url, const char* sha256Hex, const char* version, bool delta = false);
+    void abort(const char* reason);
+
+    // Does one slice of work. Returns the delay in ms before the next step,
+    // or 0 once the update has completed, failed or was never started.
+    uint32_t step();
+
+    OtaState getState() const { return state; }
+    bool isActive() const { return state == OTA_CONNECTING || state == OTA_DOWNLOADING; }
+    void printStatus();
+
+private:
+    OtaState state;
+    OtaStatusCallback statusCallback;
+
+    char host[64];
+    char path[256];
+    char version[24];
+    uint16_t port;
+    bool secure;
+    bool delta;
+    uint8_t expectedHash[32];
+
+    TlsClient secureClient;
+    WiFiClient plainClient;
+    Client* client;
+    mbedtls_sha256_context sha;
+    DeltaPatcher patcher;
+
+    size_t received;         // bytes downloaded (image or patch); the Range resume point
+    size_t imageBytes;       // image bytes hashed and written to flash
+    size_t total;            // image size, 0 until the server reports it
+    long remaining;          // bytes left in the current response, -1 until close
+    uint8_t retries;
+    uint8_t lastProgress;
+    unsigned long lastData;
+
+    bool parseUrl(const char* url);
+    bool openConnection();
+    bool restartImage();
+    uint32_t download();
+    uint32_t retry(const char* reason);
+    uint32_t finish();
+    uint32_t fail(const char* reason);
+    void report(const char* status, const char* error = nullptr);
+
+    // DeltaSink; also used directly for full images
+    bool beginImage(size_t targetSize) override;
+    bool writeImage(const uint8_t* data, size_t length) override;
+};
+
+extern OtaUpdater otaUpdater;
@@ -0,0 +1,93 @@
+// prepared_request.cpp file - Request head serialized once and patched per send
+#include "prepared_request.h"
+
+PreparedRequest::PreparedRequest()
+    : headLength(0), method(nullptr), host(nullptr), path(nullptr), contentType(nullptr),
+      authorizationOffset(0), authorizationWidth(0), messageIdOffset(0), contentLengthOffset(0) {
+    head[0] = '\0';
+}
+
+// Appends "Name: " followed by a blank slot of width bytes and returns the
+// slot offset, or 0 if the head is full
+static size_t appendSlot(char* head, size_t& length, const char* name, size_t width) {
+    int written = snprintf(head + length, PREPARED_HEAD_SIZE - length, "%s: ", name);
+    if (written < 0 || length + written + width + 2 >= PREPARED_HEAD_SIZE) {
+        return 0;
+    }
+    length += written;
+    size_t offset = length;
+    memset(head + length, ' ', width);
+    length += width;
+    memcpy(head + length, "\r\n", 2);
+    length += 2;
+    return offset;
+}
+
+bool PreparedRequest::prepare(const char* newMethod, const char* newHost, const char* newPath,
+                              const char* newContentType, size_t newAuthorizationWidth) {
+    method = newMethod;
+    host = newHost;
+    path = newPath;
+    contentType = newContentType;
+    authorizationWidth = newAuthorizationWidth;
+    headLength = 0;
+
+    size_t length = 0;
+    int written = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s\r\nContent-Type: %s\r\nConnection: close\r\n",
+                           method, path, host, contentType);
+    if (written < 0 || (size_t)written >= sizeof(head)) {
+        return false;
+    }
+    length = written;
+
+    authorizationOffset = 0;
+    if (authorizationWidth > 0) {
+        authorizationOffset = appendSlot(head, length, "Authorization", authorizationWidth);
+        if (!authorizationOffset) {
+            return false;
+        }
+    }
+    messageIdOffset = appendSlot(head, length, "iothub-messageid", PREPARED_NUMBER_WIDTH);
+    contentLengthOffset = appendSlot(head, length, "Content-Length", PREPARED_NUMBER_WIDTH);
+    if (!messageIdOffset || !contentLengthOffset || length + 3 > sizeof(head)) {
+        return false;
+    }
+
+    memcpy(head + length, "\r\n", 3);
+    headLength = length + 2;
+    return true;
+}
+
+void PreparedRequest::patch(size_t offset, size_t width, const char* value) {
+    size_t length = strlen(value);
+    if (length > width) length = width;
+    memcpy(head + offset, value, length);
+    memset(head + offset + length, ' ', width - length);
+}
+
+bool PreparedRequest::setAuthorization(const char* token) {
+    if (method == nullptr) {
+        return false;
+    }
+    size_t length = strlen(token);
+    if (length > authorizationWidth || authorizationOffset == 0 || !isPrepared()) {
+        // A new host or a longer encoded signature: serialize again
+        if (!prepare(method, host, path, contentType, length + PREPARED_TOKEN_SLACK)) {
+            return false;
+        }
+    }
+    patch(authorizationOffset, authorizationWidth, token);
+    return true;
+}
+
+void PreparedRequest::setMessageId(uint32_t id) {
+    char value[PREPARED_NUMBER_WIDTH + 1];
+    snprintf(value, sizeof(value), "%lu", (unsigned long)id);
+    patch(messageIdOffset, PREPARED_NUMBER_WIDTH, value);
+}
+
+void PreparedRequest::setContentLength(size_t length) {
+    char value[PREPARED_NUMBER_WIDTH + 1];
+    snprintf(value, sizeof(value), "%u", (unsigned)length);
+    patch(contentLengthOffset, PREPARED_NUMBER_WIDTH, value);
+}
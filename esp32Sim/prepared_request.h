@@ -0,0 +1,51 @@
+// prepared_request.h file - Request head serialized once and patched per send
+#pragma once
+
+#include <Arduino.h>
+
+#define PREPARED_HEAD_SIZE 768        // request line plus every header
+#define PREPARED_NUMBER_WIDTH 10      // digits reserved for message id / length
+#define PREPARED_TOKEN_SLACK 48       // room for a longer URL-encoded signature
+
+// A request line and header block built once, for requests that only
+// differ in a few header values. Those values live in fixed-width slots
+// and are patched in place: shorter values are padded with spaces, which
+// HTTP treats as optional whitespace after the field value. The head is
+// then ready to go out in a single socket write.
+class PreparedRequest {
+public:
+    PreparedRequest();
+
+    // Serializes the head with empty slots for the per-message values.
+    // authorizationWidth is the longest token the slot must hold; 0 leaves
+    // the header out (X.509 auth) until setAuthorization() adds it.
+    bool prepare(const char* method, const char* host, const char* path,
+                 const char* contentType, size_t authorizationWidth);
+    bool isPrepared() const { return headLength > 0; }
+
+    // Rebuilds the head when the token no longer fits its slot
+    bool setAuthorization(const char* token);
+    void setMessageId(uint32_t id);
+    void setContentLength(size_t length);
+
+    const char* getHead() const { return head; }
+    size_t getHeadLength() const { return headLength; }
+    const char* getPath() const { return path; }
+
+private:
+    char head[PREPARED_HEAD_SIZE];
+    size_t headLength;
+
+    // Kept so the head can be rebuilt with a wider token slot
+    const char* method;
+    const char* host;
+    const char* path;
+    const char* contentType;
+
+    size_t authorizationOffset;
+    size_t authorizationWidth;
+    size_t messageIdOffset;
+    size_t contentLengthOffset;
+
+    void patch(size_t offset, size_t width, const char* value);
+};
@@ -0,0 +1,91 @@
+// rate_limiter.cpp file - Adaptive token bucket for hub messages
+#include "rate_limiter.h"
+#include "logger.h"
+#include "metrics.h"
+
+static Counter rateLimited("hub.rate_limited");
+static Gauge rateMilliPerSecond("hub.rate_mps_x1000");
+
+TokenBucket::TokenBucket(const char* name, float ratePerSecond, float burst)
+    : name(name), configuredRate(ratePerSecond), rate(ratePerSecond), burst(burst),
+      tokens(burst), lastRefill(0), pausedUntil(0), paused(false) {}
+
+void TokenBucket::refill() {
+    uint32_t now = millis();
+    if (lastRefill != 0) {
+        tokens += (now - lastRefill) * rate / 1000.0f;
+        if (tokens > burst) tokens = burst;
+    }
+    lastRefill = now;
+
+    if (paused && (int32_t)(now - pausedUntil) >= 0) {
+        paused = false;
+    }
+}
+
+bool TokenBucket::tryAcquire(float cost) {
+    refill();
+    if (paused || tokens < cost) {
+        rateLimited.inc();
+        return false;
+    }
+    tokens -= cost;
+    return true;
+}
+
+bool TokenBucket::acquireUrgent(float cost) {
+    refill();
+    if (paused || tokens - cost < -burst) {
+        rateLimited.inc();
+        return false;
+    }
+    tokens -= cost;
+    return true;
+}
+
+uint32_t TokenBucket::getWaitMs(float cost) {
+    refill();
+    uint32_t wait = 0;
+    if (paused) {
+        wait = pausedUntil - millis();
+    }
+    if (tokens < cost) {
+        uint32_t refillMs = (uint32_t)((cost - tokens) * 1000.0f / rate) + 1;
+        if (refillMs > wait) wait = refillMs;
+    }
+    return wait;
+}
+
+void TokenBucket::onAccepted() {
+    if (rate < configuredRate) {
+        rate += configuredRate * RATE_INCREASE_STEP;
+        if (rate > configuredRate) rate = configuredRate;
+        rateMilliPerSecond.set((int32_t)(rate * 1000.0f));
+    }
+}
+
+void TokenBucket::onThrottled(uint32_t retryAfterMs) {
+    refill();
+    rate *= RATE_DECREASE_FACTOR;
+    if (rate < configuredRate * RATE_MIN_FRACTION) {
+        rate = configuredRate * RATE_MIN_FRACTION;
+    }
+    rateMilliPerSecond.set((int32_t)(rate * 1000.0f));
+
+    // The token we spent did not buy anything; start the next one from zero
+    tokens = 0;
+    if (retryAfterMs > 0) {
+        pausedUntil = millis() + retryAfterMs;
+        paused = true;
+    }
+    LOG_WARN("%s throttled, rate now %.3f msg/s, paused %lu ms", name, rate, (unsigned long)retryAfterMs);
+}
+
+void TokenBucket::printStatus() {
+    refill();
+    Serial.printf("%s rate limit: %.3f/%.3f msg/s, %.1f tokens", name, rate, configuredRate, tokens);
+    if (paused) {
+        Serial.printf(", paused for %lu ms", (unsigned long)(pausedUntil - millis()));
+    }
+    Serial.println();
+}
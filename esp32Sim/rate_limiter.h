@@ -0,0 +1,50 @@
+// rate_limiter.h file - Adaptive token bucket for hub messages
+#pragma once
+
+#include <Arduino.h>
+
+#define RATE_DECREASE_FACTOR 0.5f    // rate multiplier on each throttled response
+#define RATE_INCREASE_STEP 0.05f     // fraction of the configured rate regained per accepted message
+#define RATE_MIN_FRACTION 0.05f      // never slow below this fraction of the configured rate
+
+// Client-side token bucket sized from the hub quota. Tokens refill at
+// `rate` per second up to `burst`; a send spends one token per quota unit.
+//
+// The rate adapts AIMD-style: a throttled response (429/503) halves it and
+// honours Retry-After by refusing everything until then, and each accepted
+// message wins back a small step towards the configured rate. Devices thus
+// settle just under the quota instead of bouncing in and out of throttling.
+// Network task only.
+class TokenBucket {
+public:
+    TokenBucket(const char* name, float ratePerSecond, float burst);
+
+    // Takes cost tokens if available; otherwise nothing is taken
+    bool tryAcquire(float cost = 1.0f);
+
+    // For messages that cannot wait for a refill: borrows up to one burst
+    // ahead, which later tryAcquire() calls pay back. Still refused while a
+    // Retry-After pause is running.
+    bool acquireUrgent(float cost = 1.0f);
+
+    // Time until tryAcquire(cost) can succeed
+    uint32_t getWaitMs(float cost = 1.0f);
+
+    void onAccepted();
+    void onThrottled(uint32_t retryAfterMs);
+
+    float getRate() const { return rate; }
+    void printStatus();
+
+private:
+    const char* name;
+    float configuredRate;
+    float rate;
+    float burst;
+    float tokens;
+    uint32_t lastRefill;
+    uint32_t pausedUntil;
+    bool paused;
+
+    void refill();
+};
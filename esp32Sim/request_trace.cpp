@@ -0,0 +1,100 @@
+// request_trace.cpp file - Per-phase latency tracing for HTTPS requests
+#include <esp_timer.h>
+
+#include "request_trace.h"
+#include "metrics.h"
+
+static const char* const phaseNames[PHASE_COUNT] = {
+    "dns", "connect", "tls", "write", "wait", "read"
+};
+
+// One histogram per phase, in microseconds
+static Histogram dnsUs("http.dns_us");
+static Histogram connectUs("http.connect_us");
+static Histogram tlsUs("http.tls_us");
+static Histogram writeUs("http.write_us");
+static Histogram waitUs("http.wait_us");
+static Histogram readUs("http.read_us");
+static Histogram* const phaseHistograms[PHASE_COUNT] = {
+    &dnsUs, &connectUs, &tlsUs, &writeUs, &waitUs, &readUs
+};
+
+// Completed traces; only the network task writes or reads this
+static RequestTrace traceHistory[TRACE_HISTORY_SIZE];
+static uint32_t traceCount = 0;
+
+const char* requestPhaseName(RequestPhase phase) {
+    return phase < PHASE_COUNT ? phaseNames[phase] : "?";
+}
+
+RequestTrace::RequestTrace() : name(nullptr), startUs(0), finishUs(0), status(0) {
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        endUs[i] = 0;
+    }
+}
+
+RequestTrace::RequestTrace(const char* name) : name(name), startUs(esp_timer_get_time()), finishUs(0), status(0) {
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        endUs[i] = 0;
+    }
+}
+
+void RequestTrace::mark(RequestPhase phase) {
+    endUs[phase] = esp_timer_get_time();
+}
+
+int64_t RequestTrace::getPhaseStartUs(RequestPhase phase) const {
+    // A phase starts where the closest earlier completed phase ended
+    for (int i = phase - 1; i >= 0; i--) {
+        if (endUs[i]) return endUs[i];
+    }
+    return startUs;
+}
+
+uint32_t RequestTrace::getPhaseUs(RequestPhase phase) const {
+    if (!endUs[phase]) return 0;
+    return (uint32_t)(endUs[phase] - getPhaseStartUs(phase));
+}
+
+int RequestTrace::finish(int result) {
+    status = result;
+    finishUs = esp_timer_get_time();
+
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (endUs[i]) {
+            phaseHistograms[i]->record(getPhaseUs((RequestPhase)i));
+        }
+    }
+
+    traceHistory[traceCount % TRACE_HISTORY_SIZE] = *this;
+    traceCount++;
+    return result;
+}
+
+void printChromeTrace(Print& out) {
+    uint32_t available = traceCount < TRACE_HISTORY_SIZE ? traceCount : TRACE_HISTORY_SIZE;
+    uint32_t first = traceCount - available;
+    bool needComma = false;
+
+    out.print("{\"traceEvents\":[");
+    for (uint32_t n = first; n < traceCount; n++) {
+        const RequestTrace& trace = traceHistory[n % TRACE_HISTORY_SIZE];
+
+        // Whole request as the parent slice, phases nested beneath it
+        out.printf("%s{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                   "\"ts\":%lld,\"dur\":%lld,\"args\":{\"status\":%d}}",
+                   needComma ? "," : "", trace.getName(), (long long)trace.getStartUs(),
+                   (long long)(trace.getFinishUs() - trace.getStartUs()), trace.getStatus());
+        needComma = true;
+
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            uint32_t durationUs = trace.getPhaseUs((RequestPhase)i);
+            if (!durationUs) continue;
+            out.printf(",{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                       "\"ts\":%lld,\"dur\":%lu}",
+                       phaseNames[i], (long long)trace.getPhaseStartUs((RequestPhase)i),
+                       (unsigned long)durationUs);
+        }
+    }
+    out.println("]}");
+}
@@ -0,0 +1,50 @@
+// request_trace.h file - Per-phase latency tracing for HTTPS requests
+#pragma once
+
+#include <Arduino.h>
+
+#define TRACE_HISTORY_SIZE 32   // completed requests kept for Chrome trace export
+
+enum RequestPhase {
+    PHASE_DNS,
+    PHASE_CONNECT,    // TCP handshake
+    PHASE_TLS,        // TLS handshake
+    PHASE_WRITE,      // request line, headers and body
+    PHASE_WAIT,       // time to first response byte
+    PHASE_READ,       // status line, headers and body
+    PHASE_COUNT
+};
+
+// Timestamps one request with the monotonic esp_timer clock. Each mark()
+// closes a phase that started at the previous mark (or at construction);
+// finish() feeds the per-phase histograms and the trace history.
+class RequestTrace {
+public:
+    RequestTrace();
+    explicit RequestTrace(const char* name);
+
+    void mark(RequestPhase phase);
+    int finish(int status);
+
+    const char* getName() const { return name; }
+    int64_t getStartUs() const { return startUs; }
+    int64_t getFinishUs() const { return finishUs; }
+    int getStatus() const { return status; }
+
+    // Zero for phases the request never reached
+    uint32_t getPhaseUs(RequestPhase phase) const;
+    int64_t getPhaseStartUs(RequestPhase phase) const;
+
+private:
+    const char* name;
+    int64_t startUs;
+    int64_t finishUs;
+    int64_t endUs[PHASE_COUNT];
+    int status;
+};
+
+const char* requestPhaseName(RequestPhase phase);
+
+// Writes the recent request history in Chrome trace event format; load the
+// captured output in chrome://tracing or ui.perfetto.dev
+void printChromeTrace(Print& out);
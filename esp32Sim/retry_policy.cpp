@@ -0,0 +1,88 @@
+// retry_policy.cpp file - Backoff with jitter and a circuit breaker
+#include "retry_policy.h"
+#include "logger.h"
+#include "metrics.h"
+
+static Counter retryFailures("retry.failures");
+static Counter retryRejected("retry.rejected");
+static Counter circuitOpens("retry.circuit_opens");
+
+RetryPolicy::RetryPolicy(const char* name, uint32_t baseDelayMs, uint32_t maxDelayMs,
+                         uint8_t failureThreshold, uint32_t openMs)
+    : name(name), baseDelayMs(baseDelayMs), maxDelayMs(maxDelayMs),
+      failureThreshold(failureThreshold), openMs(openMs), state(CLOSED),
+      consecutiveFailures(0), lastDelayMs(baseDelayMs), nextAttemptAt(0), waiting(false) {}
+
+bool RetryPolicy::allowRequest() {
+    if (waiting && (int32_t)(millis() - nextAttemptAt) < 0) {
+        retryRejected.inc();
+        return false;
+    }
+    waiting = false;
+
+    if (state == OPEN) {
+        state = HALF_OPEN;
+        LOG_INFO("%s circuit half-open, sending probe", name);
+    }
+    return true;
+}
+
+void RetryPolicy::recordSuccess() {
+    if (state != CLOSED) {
+        LOG_INFO("%s circuit closed", name);
+    }
+    state = CLOSED;
+    consecutiveFailures = 0;
+    lastDelayMs = baseDelayMs;
+    waiting = false;
+}
+
+void RetryPolicy::recordFailure() {
+    retryFailures.inc();
+    if (consecutiveFailures < 255) {
+        consecutiveFailures++;
+    }
+
+    uint32_t delayMs;
+    if (state == HALF_OPEN || consecutiveFailures >= failureThreshold) {
+        // Hold off for the open period; jitter it so a fleet does not
+        // probe the endpoint all at once
+        if (state != OPEN) {
+            circuitOpens.inc();
+            LOG_WARN("%s circuit open after %u consecutive failures", name, consecutiveFailures);
+        }
+        state = OPEN;
+        delayMs = openMs + random(0, openMs / 2 + 1);
+    } else {
+        // Decorrelated jitter: random in [base, 3 * previous], capped
+        uint32_t upper = lastDelayMs * 3;
+        if (upper > maxDelayMs || upper < lastDelayMs) upper = maxDelayMs;
+        delayMs = random(baseDelayMs, upper + 1);
+        lastDelayMs = delayMs;
+    }
+
+    nextAttemptAt = millis() + delayMs;
+    waiting = true;
+    LOG_DEBUG("%s retry in %lu ms", name, (unsigned long)delayMs);
+}
+
+uint32_t RetryPolicy::getRetryDelayMs() const {
+    if (!waiting) {
+        return 0;
+    }
+    int32_t remaining = (int32_t)(nextAttemptAt - millis());
+    return remaining > 0 ? remaining : 0;
+}
+
+void RetryPolicy::printStatus() {
+    static const char* const stateNames[] = {"closed", "open", "half-open"};
+    Serial.printf("%s circuit: %s (%u consecutive failures", name, stateNames[state], consecutiveFailures);
+    if (waiting) {
+        Serial.printf(", next attempt in %lu ms", (unsigned long)getRetryDelayMs());
+    }
+    Serial.println(")");
+}
+
+bool isRetryableStatus(int httpCode) {
+    return httpCode < 0 || httpCode == 408 || httpCode == 429 || httpCode >= 500;
+}
@@ -0,0 +1,53 @@
+// retry_policy.h file - Backoff with jitter and a circuit breaker
+#pragma once
+
+#include <Arduino.h>
+
+// Spaces out retries of a failing endpoint and stops calling it altogether
+// while it looks down.
+//
+// Each failure pushes the next allowed attempt out by a decorrelated-jitter
+// delay: random between the base delay and three times the previous delay,
+// capped at maxDelayMs. Devices that failed together therefore drift apart
+// instead of reconnecting in lockstep. After failureThreshold consecutive
+// failures the circuit opens and every request is refused for openMs (plus
+// up to 50% jitter); the first request after that is a half-open probe
+// whose result closes or re-opens the circuit.
+// Network task only.
+class RetryPolicy {
+public:
+    enum State { CLOSED, OPEN, HALF_OPEN };
+
+    RetryPolicy(const char* name, uint32_t baseDelayMs, uint32_t maxDelayMs,
+                uint8_t failureThreshold, uint32_t openMs);
+
+    // False while backing off or while the circuit is open
+    bool allowRequest();
+
+    void recordSuccess();
+    void recordFailure();
+
+    // Time until allowRequest() will next return true (0 if it already does)
+    uint32_t getRetryDelayMs() const;
+
+    State getState() const { return state; }
+    uint8_t getConsecutiveFailures() const { return consecutiveFailures; }
+    void printStatus();
+
+private:
+    const char* name;
+    uint32_t baseDelayMs;
+    uint32_t maxDelayMs;
+    uint8_t failureThreshold;
+    uint32_t openMs;
+
+    State state;
+    uint8_t consecutiveFailures;
+    uint32_t lastDelayMs;
+    uint32_t nextAttemptAt;
+    bool waiting;            // nextAttemptAt is in force
+};
+
+// HTTP results worth retrying: transport errors, timeouts, throttling and
+// server errors. Anything else will fail the same way again.
+bool isRetryableStatus(int httpCode);
@@ -0,0 +1,187 @@
+// sas_token_cache.cpp file - SAS tokens shared across identities, refreshed on a spread schedule
+#include <ctype.h>
+#include <esp_timer.h>
+#include <time.h>
+
+#include "sas_token_cache.h"
+#include "crypto_backend.h"
+#include "logger.h"
+#include "metrics.h"
+
+#define SAS_TOKEN_BUCKETS (SAS_TOKEN_LIFETIME / SAS_TOKEN_BUCKET_SECONDS)
+#define SAS_TOKEN_SLOT_STRIDE 37   // coprime with the bucket count: slots 0, 37, 14, 51, ...
+
+SasTokenCache sasTokenCache;
+
+static Counter sasTokensSigned("sas.tokens_signed");
+static Counter sasTokensSignedLate("sas.tokens_signed_on_demand");
+static Histogram sasSignUs("sas.sign_us");
+
+// Percent-encodes everything but unreserved characters, like encodeURIComponent
+static size_t urlEncode(const char* in, size_t inLength, char* out, size_t size) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t length = 0;
+    for (size_t i = 0; i < inLength; i++) {
+        char c = in[i];
+        if (isalnum((unsigned char)c) || strchr("-_.~", c)) {
+            if (length + 1 >= size) return 0;
+            out[length++] = c;
+        } else {
+            if (length + 3 >= size) return 0;
+            out[length++] = '%';
+            out[length++] = hex[(uint8_t)c >> 4];
+            out[length++] = hex[(uint8_t)c & 0x0f];
+        }
+    }
+    out[length] = '\0';
+    return length;
+}
+
+SasTokenCache::SasTokenCache() : nextSlot(0), signs(0) {
+    memset(entries, 0, sizeof(entries));
+}
+
+int SasTokenCache::add(const char* resourceUri, const char* base64Key, const char* keyName) {
+    int freeIndex = -1;
+    for (int i = 0; i < SAS_TOKEN_CACHE_SIZE; i++) {
+        if (entries[i].used && strcmp(entries[i].resourceUri, resourceUri) == 0) {
+            return i;
+        }
+        if (!entries[i].used && freeIndex < 0) {
+            freeIndex = i;
+        }
+    }
+    if (freeIndex < 0 || strlen(resourceUri) >= SAS_TOKEN_URI_MAX) {
+        LOG_ERROR("No SAS token cache entry for %s", resourceUri);
+        return -1;
+    }
+
+    Entry& entry = entries[freeIndex];
+    size_t keyLength;
+    if (!getCryptoBackend().base64Decode(base64Key, strlen(base64Key), entry.key, sizeof(entry.key), &keyLength)) {
+        LOG_ERROR("Failed to decode the key for %s", resourceUri);
+        return -1;
+    }
+    snprintf(entry.resourceUri, sizeof(entry.resourceUri), "%s", resourceUri);
+    entry.keyName = keyName;
+    entry.keyLength = keyLength;
+    entry.tokenLength = 0;
+    entry.expiry = 0;
+    entry.phase = (uint16_t)((nextSlot++ * SAS_TOKEN_SLOT_STRIDE) % SAS_TOKEN_BUCKETS * SAS_TOKEN_BUCKET_SECONDS);
+    entry.used = true;
+    return freeIndex;
+}
+
+void SasTokenCache::remove(int handle) {
+    if (handle >= 0 && handle < SAS_TOKEN_CACHE_SIZE) {
+        memset(&entries[handle], 0, sizeof(Entry));
+    }
+}
+
+bool SasTokenCache::sign(Entry& entry, uint32_t now) {
+    int64_t start = esp_timer_get_time();
+
+    // The latest expiry on this entry's phase within a lifetime from now;
+    // if that leaves less than half a lifetime, the one after it
+    uint32_t latest = now + SAS_TOKEN_LIFETIME;
+    uint32_t expiry = latest - (latest - entry.phase) % SAS_TOKEN_LIFETIME;
+    if (expiry - now < SAS_TOKEN_LIFETIME / 2) {
+        expiry += SAS_TOKEN_LIFETIME;
+    }
+
+    char encodedUri[SAS_TOKEN_URI_MAX * 3];
+    char stringToSign[sizeof(encodedUri) + 12];
+    size_t uriLength = urlEncode(entry.resourceUri, strlen(entry.resourceUri), encodedUri, sizeof(encodedUri));
+    int signLength = snprintf(stringToSign, sizeof(stringToSign), "%s\n%lu", encodedUri, (unsigned long)expiry);
+
+    CryptoBackend& crypto = getCryptoBackend();
+    uint8_t digest[CRYPTO_SHA256_SIZE];
+    char signature[48];
+    char encodedSignature[sizeof(signature) * 3];
+    size_t signatureLength;
+    if (uriLength == 0 ||
+        !crypto.hmacSha256(entry.key, entry.keyLength, (const uint8_t*)stringToSign, signLength, digest) ||
+        !crypto.base64Encode(digest, sizeof(digest), signature, sizeof(signature), &signatureLength) ||
+        urlEncode(signature, signatureLength, encodedSignature, sizeof(encodedSignature)) == 0) {
+        LOG_ERROR("Failed to sign a SAS token for %s", entry.resourceUri);
+        return false;
+    }
+
+    int length = snprintf(entry.token, sizeof(entry.token), "SharedAccessSignature sr=%s&sig=%s&se=%lu%s%s",
+                          encodedUri, encodedSignature, (unsigned long)expiry,
+                          entry.keyName ? "&skn=" : "", entry.keyName ? entry.keyName : "");
+    if (length < 0 || (size_t)length >= sizeof(entry.token)) {
+        LOG_ERROR("SAS token for %s does not fit in %u bytes", entry.resourceUri, SAS_TOKEN_MAX);
+        entry.tokenLength = 0;
+        return false;
+    }
+
+    entry.tokenLength = length;
+    entry.expiry = expiry;
+    signs++;
+    sasTokensSigned.inc();
+    sasSignUs.record((uint32_t)(esp_timer_get_time() - start));
+    LOG_DEBUG("SAS token for %s valid until %lu", entry.resourceUri, (unsigned long)expiry);
+    return true;
+}
+
+bool SasTokenCache::get(int handle, SasTokenView& view) {
+    if (handle < 0 || handle >= SAS_TOKEN_CACHE_SIZE || !entries[handle].used) {
+        return false;
+    }
+
+    Entry& entry = entries[handle];
+    uint32_t now = time(NULL);
+    if (entry.tokenLength == 0 || now >= entry.expiry) {
+        // New, or refreshDue() did not get to it in time; only the latter
+        // counts as signed on demand
+        bool expired = entry.tokenLength != 0;
+        if (!sign(entry, now)) {
+            return false;
+        }
+        if (expired) {
+            sasTokensSignedLate.inc();
+        }
+    }
+
+    view.token = entry.token;
+    view.length = entry.tokenLength;
+    view.expiry = entry.expiry;
+    return true;
+}
+
+uint32_t SasTokenCache::refreshDue(uint32_t maxSigns) {
+    uint32_t now = time(NULL);
+    uint32_t signedCount = 0;
+
+    // Soonest expiry first, so a backlog drains in order
+    while (signedCount < maxSigns) {
+        Entry* due = nullptr;
+        for (int i = 0; i < SAS_TOKEN_CACHE_SIZE; i++) {
+            Entry& entry = entries[i];
+            if (!entry.used || entry.tokenLength == 0 || entry.expiry > now + SAS_TOKEN_REFRESH_MARGIN) continue;
+            if (due == nullptr || entry.expiry < due->expiry) due = &entry;
+        }
+        if (due == nullptr || !sign(*due, now)) {
+            break;
+        }
+        signedCount++;
+    }
+    return signedCount;
+}
+
+void SasTokenCache::printStatus() {
+    uint32_t now = time(NULL);
+    int active = 0;
+    uint32_t nextExpiry = 0;
+    for (int i = 0; i < SAS_TOKEN_CACHE_SIZE; i++) {
+        if (!entries[i].used || entries[i].tokenLength == 0) continue;
+        active++;
+        if (nextExpiry == 0 || entries[i].expiry < nextExpiry) nextExpiry = entries[i].expiry;
+    }
+    Serial.printf("SAS tokens: %d/%d cached, %lu signed", active, SAS_TOKEN_CACHE_SIZE, (unsigned long)signs);
+    if (nextExpiry > now) {
+        Serial.printf(", next expiry in %lu s", (unsigned long)(nextExpiry - now));
+    }
+    Serial.println();
+}
@@ -0,0 +1,67 @@
+// sas_token_cache.h file - SAS tokens shared across identities, refreshed on a spread schedule
+#pragma once
+
+#include <Arduino.h>
+
+#include "gateway.h"
+
+#define SAS_TOKEN_CACHE_SIZE (1 + GATEWAY_CHILD_COUNT)  // the device's hub token plus one per child
+#define SAS_TOKEN_LIFETIME 3600          // s; tokens live between half and one and a half of this
+#define SAS_TOKEN_REFRESH_MARGIN 300     // s before expiry a token is due for refresh
+#define SAS_TOKEN_BUCKET_SECONDS 60      // expiries fall on one of LIFETIME / BUCKET slots
+#define SAS_TOKEN_MAX_SIGNS_PER_STEP 4   // signatures one refreshDue() call may compute
+#define SAS_TOKEN_URI_MAX 128
+#define SAS_TOKEN_MAX 256
+
+// A token owned by the cache. Valid until the next call that can sign
+// (get() or refreshDue()), so use it straight away rather than storing it.
+struct SasTokenView {
+    const char* token;
+    size_t length;
+    uint32_t expiry;     // Unix time
+};
+
+// One signed token per resource URI (e.g. "<hub>/devices/<id>"). Each
+// entry's expiry is pinned to its own slot of the hour, with slots handed
+// out so consecutive entries are spread evenly, so refreshes never bunch
+// up however many identities are active. refreshDue() renews tokens
+// ahead of expiry, at most SAS_TOKEN_MAX_SIGNS_PER_STEP per call; get()
+// only signs when a token is missing or already expired.
+// Network task only.
+class SasTokenCache {
+public:
+    SasTokenCache();
+
+    // Registers a resource signed with a base64 key; returns its handle,
+    // the existing handle if already registered, or -1 when full
+    int add(const char* resourceUri, const char* base64Key, const char* keyName = nullptr);
+    void remove(int handle);
+
+    bool get(int handle, SasTokenView& view);
+
+    // Renews the tokens closest to expiry; returns how many were signed
+    uint32_t refreshDue(uint32_t maxSigns = SAS_TOKEN_MAX_SIGNS_PER_STEP);
+
+    void printStatus();
+
+private:
+    struct Entry {
+        char resourceUri[SAS_TOKEN_URI_MAX];
+        const char* keyName;        // "registration" for DPS; none for device tokens
+        uint8_t key[64];
+        size_t keyLength;
+        char token[SAS_TOKEN_MAX];
+        size_t tokenLength;
+        uint32_t expiry;
+        uint16_t phase;             // s into the hour the expiry is aligned to
+        bool used;
+    };
+
+    Entry entries[SAS_TOKEN_CACHE_SIZE];
+    uint16_t nextSlot;
+    uint32_t signs;
+
+    bool sign(Entry& entry, uint32_t now);
+};
+
+extern SasTokenCache sasTokenCache;
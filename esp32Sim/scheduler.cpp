@@ -0,0 +1,229 @@
+// scheduler.cpp file - Deadline-based cooperative task scheduler
+#include <esp_pm.h>
+
+#include "scheduler.h"
+#include "logger.h"
+
+// Global scheduler instance driven from loop()
+TaskScheduler scheduler;
+
+TaskScheduler::TaskScheduler() : taskCount(0), ownerTask(nullptr), wakeups(0), idleWakeups(0) {}
+
+void TaskScheduler::begin() {
+    ownerTask = xTaskGetCurrentTaskHandle();
+
+#if CONFIG_PM_ENABLE
+    // Let the idle task scale the clock down and, if the core was built with
+    // tickless idle, enter light sleep while every task is waiting on its deadline
+    esp_pm_config_t pmConfig = {};
+    pmConfig.max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+    pmConfig.min_freq_mhz = 40;
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    pmConfig.light_sleep_enable = true;
+#endif
+    if (esp_pm_configure(&pmConfig) != 0) {
+        LOG_WARN("Scheduler: power management not available, idling without light sleep");
+    }
+#endif
+}
+
+int TaskScheduler::addTask(const char* name, TaskCallback callback, uint32_t periodMs, uint32_t initialDelayMs) {
+    if (taskCount >= SCHEDULER_MAX_TASKS || callback == nullptr) {
+        return -1;
+    }
+
+    int id = taskCount++;
+    Task& task = tasks[id];
+    task.name = name;
+    task.callback = callback;
+    task.periodMs = periodMs;
+    task.deadline = millis() + initialDelayMs;
+    task.armed = periodMs > 0 || initialDelayMs > 0;
+    task.pending.store(false);
+    memset(&task.stats, 0, sizeof(task.stats));
+
+    heap[id] = id;
+    heapIndex[id] = id;
+    siftUp(id);
+    return id;
+}
+
+void TaskScheduler::setPeriod(int taskId, uint32_t periodMs) {
+    if (taskId < 0 || taskId >= taskCount) return;
+
+    Task& task = tasks[taskId];
+    if (task.periodMs == periodMs) return;
+
+    // Pull the pending deadline in if the new period is shorter, so a
+    // tightened interval takes effect now rather than after one old period
+    uint32_t now = millis();
+    if (task.armed && periodMs > 0 && (int32_t)(task.deadline - (now + periodMs)) > 0) {
+        task.deadline = now + periodMs;
+    }
+    if (!task.armed && periodMs > 0) {
+        task.deadline = now + periodMs;
+        task.armed = true;
+    }
+    task.periodMs = periodMs;
+    reposition(taskId);
+}
+
+uint32_t TaskScheduler::getPeriod(int taskId) const {
+    if (taskId < 0 || taskId >= taskCount) return 0;
+    return tasks[taskId].periodMs;
+}
+
+void TaskScheduler::runNow(int taskId) {
+    if (taskId < 0 || taskId >= taskCount) return;
+
+    tasks[taskId].pending.store(true, std::memory_order_release);
+    if (ownerTask != nullptr && xTaskGetCurrentTaskHandle() != ownerTask) {
+        xTaskNotifyGive(ownerTask);
+    }
+}
+
+void TaskScheduler::runAfter(int taskId, uint32_t delayMs) {
+    if (taskId < 0 || taskId >= taskCount) return;
+
+    Task& task = tasks[taskId];
+    task.deadline = millis() + delayMs;
+    task.armed = true;
+    reposition(taskId);
+}
+
+void TaskScheduler::run() {
+    uint32_t now = millis();
+    bool ranTask = false;
+    wakeups++;
+
+    // Promote wake-up requests posted from other tasks
+    for (int id = 0; id < taskCount; id++) {
+        if (tasks[id].pending.exchange(false, std::memory_order_acquire)) {
+            tasks[id].deadline = now;
+            tasks[id].armed = true;
+            reposition(id);
+        }
+    }
+
+    while (taskCount > 0) {
+        int id = heap[0];
+        if (!tasks[id].armed || !isDue(tasks[id].deadline, now)) {
+            break;
+        }
+        dispatch(id, now);
+        ranTask = true;
+        now = millis();
+    }
+
+    if (!ranTask) {
+        idleWakeups++;
+    }
+
+    // Block until the earliest deadline; runNow() from another task cuts this short
+    TickType_t waitTicks = portMAX_DELAY;
+    for (int id = 0; id < taskCount; id++) {
+        if (tasks[id].pending.load(std::memory_order_relaxed)) return;
+    }
+    if (taskCount > 0 && tasks[heap[0]].armed) {
+        uint32_t deadline = tasks[heap[0]].deadline;
+        uint32_t waitMs = isDue(deadline, now) ? 0 : deadline - now;
+        waitTicks = pdMS_TO_TICKS(waitMs);
+    }
+    if (waitTicks > 0) {
+        ulTaskNotifyTake(pdTRUE, waitTicks);
+    }
+}
+
+void TaskScheduler::dispatch(int taskId, uint32_t now) {
+    Task& task = tasks[taskId];
+    TaskStats& stats = task.stats;
+
+    uint32_t lateMs = now - task.deadline;
+    stats.runs++;
+    stats.lastLateMs = lateMs;
+    stats.lateTotalMs += lateMs;
+    if (lateMs > stats.lateMaxMs) stats.lateMaxMs = lateMs;
+
+    // Advance on the original grid so lateness does not accumulate as drift.
+    // The callback may still override this with runAfter()/setPeriod().
+    if (task.periodMs > 0) {
+        uint32_t next = task.deadline + task.periodMs;
+        if (isDue(next, now)) {
+            uint32_t missed = (now - next) / task.periodMs + 1;
+            stats.missedPeriods += missed;
+            next += missed * task.periodMs;
+        }
+        task.deadline = next;
+    } else {
+        task.armed = false;
+    }
+    reposition(taskId);
+
+    uint32_t start = millis();
+    task.callback();
+    uint32_t execMs = millis() - start;
+    if (execMs > stats.execMaxMs) stats.execMaxMs = execMs;
+}
+
+const TaskScheduler::TaskStats* TaskScheduler::getStats(int taskId) const {
+    if (taskId < 0 || taskId >= taskCount) return nullptr;
+    return &tasks[taskId].stats;
+}
+
+void TaskScheduler::printStats() {
+    Serial.println("\n=== Scheduler ===");
+    Serial.printf("Wakeups: %lu (idle: %lu)\n", (unsigned long)wakeups, (unsigned long)idleWakeups);
+    Serial.println("Task         Period   Runs   Late avg/max ms  Exec max ms  Missed");
+    for (int id = 0; id < taskCount; id++) {
+        const Task& task = tasks[id];
+        const TaskStats& stats = task.stats;
+        uint32_t lateAvg = stats.runs ? stats.lateTotalMs / stats.runs : 0;
+        Serial.printf("%-12s %6lu %6lu   %6lu/%-6lu     %6lu     %6lu\n",
+                      task.name, (unsigned long)task.periodMs, (unsigned long)stats.runs,
+                      (unsigned long)lateAvg, (unsigned long)stats.lateMaxMs,
+                      (unsigned long)stats.execMaxMs, (unsigned long)stats.missedPeriods);
+    }
+    Serial.println("=================\n");
+}
+
+bool TaskScheduler::earlier(uint8_t a, uint8_t b) const {
+    // Disarmed (on-demand) tasks sort after everything that has a deadline
+    if (tasks[a].armed != tasks[b].armed) return tasks[a].armed;
+    return (int32_t)(tasks[a].deadline - tasks[b].deadline) < 0;
+}
+
+void TaskScheduler::swapNodes(int i, int j) {
+    uint8_t tmp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = tmp;
+    heapIndex[heap[i]] = i;
+    heapIndex[heap[j]] = j;
+}
+
+void TaskScheduler::siftUp(int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!earlier(heap[i], heap[parent])) break;
+        swapNodes(i, parent);
+        i = parent;
+    }
+}
+
+void TaskScheduler::siftDown(int i) {
+    for (;;) {
+        int left = 2 * i + 1;
+        int right = left + 1;
+        int smallest = i;
+        if (left < taskCount && earlier(heap[left], heap[smallest])) smallest = left;
+        if (right < taskCount && earlier(heap[right], heap[smallest])) smallest = right;
+        if (smallest == i) break;
+        swapNodes(i, smallest);
+        i = smallest;
+    }
+}
+
+void TaskScheduler::reposition(int taskId) {
+    int i = heapIndex[taskId];
+    siftUp(i);
+    siftDown(heapIndex[taskId]);
+}
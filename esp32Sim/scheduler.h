@@ -0,0 +1,82 @@
+// scheduler.h file - Deadline-based cooperative task scheduler
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#define SCHEDULER_MAX_TASKS 16
+
+// Runs each registered task at its own deadline instead of a fixed polling
+// tick. Tasks live in a min-heap ordered by deadline; between deadlines the
+// calling task blocks on a FreeRTOS notification so the idle task (and light
+// sleep, when power management allows it) gets the CPU.
+class TaskScheduler {
+public:
+    typedef void (*TaskCallback)();
+
+    struct TaskStats {
+        uint32_t runs;
+        uint32_t lateTotalMs;   // sum of (start - deadline), for the mean
+        uint32_t lateMaxMs;
+        uint32_t lastLateMs;
+        uint32_t execMaxMs;
+        uint32_t missedPeriods; // deadlines skipped because a run overran them
+    };
+
+    TaskScheduler();
+
+    // Must be called from the task that will call run()
+    void begin();
+
+    // periodMs == 0 registers an on-demand task that only runs after runNow()
+    // or runAfter(). Returns the task id, or -1 if the table is full.
+    int addTask(const char* name, TaskCallback callback, uint32_t periodMs, uint32_t initialDelayMs = 0);
+
+    void setPeriod(int taskId, uint32_t periodMs);
+    uint32_t getPeriod(int taskId) const;
+
+    // Safe to call from other tasks and callbacks; wakes the scheduler
+    void runNow(int taskId);
+
+    // Scheduler context only: move the task's next deadline to now + delayMs
+    void runAfter(int taskId, uint32_t delayMs);
+
+    // Dispatches every task whose deadline has passed, then sleeps until the
+    // earliest deadline or until runNow() is called
+    void run();
+
+    const TaskStats* getStats(int taskId) const;
+    void printStats();
+
+private:
+    struct Task {
+        const char* name;
+        TaskCallback callback;
+        uint32_t periodMs;
+        uint32_t deadline;
+        bool armed;
+        std::atomic<bool> pending;
+        TaskStats stats;
+    };
+
+    Task tasks[SCHEDULER_MAX_TASKS];
+    uint8_t heap[SCHEDULER_MAX_TASKS];    // task ids, earliest deadline first
+    uint8_t heapIndex[SCHEDULER_MAX_TASKS];
+    int taskCount;
+    TaskHandle_t ownerTask;
+    uint32_t wakeups;
+    uint32_t idleWakeups;                 // woke up with nothing to run
+
+    static bool isDue(uint32_t deadline, uint32_t now) {
+        return (int32_t)(now - deadline) >= 0;
+    }
+
+    bool earlier(uint8_t a, uint8_t b) const;
+    void swapNodes(int i, int j);
+    void siftUp(int i);
+    void siftDown(int i);
+    void reposition(int taskId);
+    void dispatch(int taskId, uint32_t now);
+};
+
+extern TaskScheduler scheduler;
@@ -0,0 +1,165 @@
+// sensors.cpp file - Sensor sampling and aggregation
+#include "sensors.h"
+#include "spsc_queue.h"
+
+// Sensing core -> network core
+static SpscQueue<SampleRecord, SAMPLE_QUEUE_SIZE> sampleQueue;
+static SpscQueue<AlertRecord, ALERT_QUEUE_SIZE> alertQueue;
+static TaskHandle_t sensingTaskHandle = nullptr;
+static void (*alertCallback)() = nullptr;
+
+// Sensing core state
+static bool temperatureAlert = false;
+static bool batteryAlert = false;
+
+// Network core state
+static SampleRecord telemetryWindow;
+static SampleRecord lastRecord;
+static bool hasRecord = false;
+
+static SensorSample readSensors() {
+    SensorSample sample;
+    // Sample sensor data (replace with actual sensor readings)
+    sample.timestampMs = millis();
+    sample.temperature = 22.5 + (random(-50, 50) / 10.0); // Simulated temperature
+    sample.humidity = 45.0 + (random(-100, 100) / 10.0);  // Simulated humidity
+    sample.batteryLevel = random(85, 100);                 // Simulated battery
+    return sample;
+}
+
+// Folds src into dst, weighting averages by sample count
+static void mergeRecord(SampleRecord& dst, const SampleRecord& src) {
+    if (dst.sampleCount == 0) {
+        dst = src;
+        return;
+    }
+
+    float total = dst.sampleCount + src.sampleCount;
+    dst.temperatureAvg = (dst.temperatureAvg * dst.sampleCount + src.temperatureAvg * src.sampleCount) / total;
+    dst.humidityAvg = (dst.humidityAvg * dst.sampleCount + src.humidityAvg * src.sampleCount) / total;
+    if (src.temperatureMin < dst.temperatureMin) dst.temperatureMin = src.temperatureMin;
+    if (src.temperatureMax > dst.temperatureMax) dst.temperatureMax = src.temperatureMax;
+    dst.batteryLevel = src.batteryLevel;
+    dst.timestampMs = src.timestampMs;  // firstTimestampMs stays the oldest
+    dst.sampleCount += src.sampleCount;
+}
+
+static void raiseAlert(const SensorSample& sample, AlertType type, bool raised, float value, float threshold) {
+    AlertRecord alert;
+    alert.timestampMs = sample.timestampMs;
+    alert.type = type;
+    alert.raised = raised;
+    alert.value = value;
+    alert.threshold = threshold;
+    if (alertQueue.push(alert) && alertCallback) {
+        alertCallback();
+    }
+}
+
+// Checked on every sample rather than on the aggregated record, so an alert
+// leaves the sensing core within one sample period
+static void checkAlerts(const SensorSample& sample) {
+    if (!temperatureAlert && sample.temperature > ALERT_TEMPERATURE_HIGH) {
+        temperatureAlert = true;
+        raiseAlert(sample, ALERT_TEMPERATURE, true, sample.temperature, ALERT_TEMPERATURE_HIGH);
+    } else if (temperatureAlert && sample.temperature < ALERT_TEMPERATURE_HIGH - ALERT_TEMPERATURE_HYSTERESIS) {
+        temperatureAlert = false;
+        raiseAlert(sample, ALERT_TEMPERATURE, false, sample.temperature, ALERT_TEMPERATURE_HIGH);
+    }
+
+    if (!batteryAlert && sample.batteryLevel < ALERT_BATTERY_CRITICAL) {
+        batteryAlert = true;
+        raiseAlert(sample, ALERT_BATTERY, true, sample.batteryLevel, ALERT_BATTERY_CRITICAL);
+    } else if (batteryAlert && sample.batteryLevel >= ALERT_BATTERY_CRITICAL + ALERT_BATTERY_HYSTERESIS) {
+        batteryAlert = false;
+        raiseAlert(sample, ALERT_BATTERY, false, sample.batteryLevel, ALERT_BATTERY_CRITICAL);
+    }
+}
+
+static void sensingTask(void* param) {
+    SampleRecord record = {};
+    TickType_t lastWake = xTaskGetTickCount();
+
+    for (;;) {
+        SensorSample sample = readSensors();
+        checkAlerts(sample);
+
+        SampleRecord single;
+        single.timestampMs = sample.timestampMs;
+        single.firstTimestampMs = sample.timestampMs;
+        single.sampleCount = 1;
+        single.temperatureMin = sample.temperature;
+        single.temperatureMax = sample.temperature;
+        single.temperatureAvg = sample.temperature;
+        single.humidityAvg = sample.humidity;
+        single.batteryLevel = sample.batteryLevel;
+        mergeRecord(record, single);
+
+        if (record.sampleCount >= SAMPLES_PER_RECORD) {
+            // Never blocks: a full queue drops the record and counts an overflow
+            sampleQueue.push(record);
+            record.sampleCount = 0;
+        }
+
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(SENSOR_SAMPLE_INTERVAL));
+    }
+}
+
+void startSensingTask() {
+    if (sensingTaskHandle) {
+        return;
+    }
+    xTaskCreatePinnedToCore(sensingTask, "sensing", SENSING_TASK_STACK, nullptr,
+                            SENSING_TASK_PRIORITY, &sensingTaskHandle, SENSING_CORE);
+}
+
+void onSensorAlert(void (*callback)()) {
+    alertCallback = callback;
+}
+
+bool popAlert(AlertRecord& alert) {
+    return alertQueue.pop(alert);
+}
+
+size_t queuedAlerts() {
+    return alertQueue.size();
+}
+
+const char* alertName(AlertType type) {
+    switch (type) {
+        case ALERT_TEMPERATURE: return "temperatureHigh";
+        case ALERT_BATTERY: return "batteryCritical";
+    }
+    return "unknown";
+}
+
+void drainSampleQueue() {
+    SampleRecord record;
+    while (sampleQueue.pop(record)) {
+        mergeRecord(telemetryWindow, record);
+        lastRecord = record;
+        hasRecord = true;
+    }
+}
+
+SampleRecord getTelemetryWindow() {
+    drainSampleQueue();
+    if (telemetryWindow.sampleCount == 0 && hasRecord) {
+        return lastRecord;
+    }
+    return telemetryWindow;
+}
+
+void resetTelemetryWindow() {
+    telemetryWindow.sampleCount = 0;
+}
+
+void printSensingStats() {
+    Serial.printf("Sample Queue: %u/%u records (high water %lu, overflows %lu, pushed %lu)\n",
+                  (unsigned)sampleQueue.size(), (unsigned)sampleQueue.capacity(),
+                  (unsigned long)sampleQueue.getHighWater(), (unsigned long)sampleQueue.getOverflows(),
+                  (unsigned long)sampleQueue.getPushed());
+    Serial.printf("Alert Queue: %u/%u alerts (overflows %lu, raised %lu)\n",
+                  (unsigned)alertQueue.size(), (unsigned)alertQueue.capacity(),
+                  (unsigned long)alertQueue.getOverflows(), (unsigned long)alertQueue.getPushed());
+}
@@ -0,0 +1,90 @@
+// sensors.h file - Sensor sampling and aggregation
+#pragma once
+
+#include <Arduino.h>
+
+#define SENSOR_SAMPLE_INTERVAL 250  // Sampling period in milliseconds
+#define SAMPLES_PER_RECORD 4        // Samples aggregated into one queued record
+#define SAMPLE_QUEUE_SIZE 32        // Records buffered between the cores (power of two)
+// The network core drains the queue on its own schedule, well inside the
+// ~32 s it holds, so telemetry periods of any length aggregate every record
+#define SAMPLE_DRAIN_INTERVAL (SAMPLE_QUEUE_SIZE * SAMPLES_PER_RECORD * SENSOR_SAMPLE_INTERVAL / 4)
+
+#if CONFIG_FREERTOS_UNICORE
+#define SENSING_CORE 0
+#define NETWORK_CORE 0
+#else
+#define SENSING_CORE 1              // APP_CPU: sampling never shares a core with TLS
+#define NETWORK_CORE 0              // PRO_CPU: alongside the WiFi/lwIP tasks
+#endif
+
+#define SENSING_TASK_PRIORITY 5
+#define SENSING_TASK_STACK 3072
+
+#define ALERT_QUEUE_SIZE 8          // alerts waiting for the network core (power of two)
+
+// Alert thresholds; override in secret_configs.h. An alert clears once the
+// reading is back past the threshold by the hysteresis.
+#ifndef ALERT_TEMPERATURE_HIGH
+#define ALERT_TEMPERATURE_HIGH 30.0f
+#endif
+#define ALERT_TEMPERATURE_HYSTERESIS 1.0f
+#ifndef ALERT_BATTERY_CRITICAL
+#define ALERT_BATTERY_CRITICAL 10   // percent
+#endif
+#define ALERT_BATTERY_HYSTERESIS 5
+
+struct SensorSample {
+    uint32_t timestampMs;
+    float temperature;
+    float humidity;
+    uint8_t batteryLevel;
+};
+
+// Fixed-size record handed from the sensing core to the network core
+struct SampleRecord {
+    uint32_t timestampMs;           // time of the newest sample in the record
+    uint32_t firstTimestampMs;      // time of the oldest
+    uint16_t sampleCount;
+    float temperatureMin;
+    float temperatureMax;
+    float temperatureAvg;
+    float humidityAvg;
+    uint8_t batteryLevel;           // latest reading
+};
+
+enum AlertType : uint8_t {
+    ALERT_TEMPERATURE,
+    ALERT_BATTERY,
+};
+
+// A threshold crossing, raised (or cleared) on the sample that crossed it
+struct AlertRecord {
+    uint32_t timestampMs;           // time of that sample
+    AlertType type;
+    bool raised;                    // false: back within the threshold
+    float value;
+    float threshold;
+};
+
+// Starts the sampling/aggregation task pinned to SENSING_CORE
+void startSensingTask();
+
+// Called on the sensing core whenever an alert is queued; must only wake
+// the network side (e.g. TaskScheduler::runNow)
+void onSensorAlert(void (*callback)());
+
+// Network core: the alert lane, oldest first
+bool popAlert(AlertRecord& alert);
+size_t queuedAlerts();
+const char* alertName(AlertType type);
+
+// Network core: merges queued records into the current telemetry window
+void drainSampleQueue();
+
+// Aggregate of every record since the last reset (drains the queue first).
+// Falls back to the newest record seen if the window is still empty.
+SampleRecord getTelemetryWindow();
+void resetTelemetryWindow();
+
+void printSensingStats();
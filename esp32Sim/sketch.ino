@@ -1,12 +1,243 @@
 // sketch.ino file - Enhanced with telemetry
 #include <Update.h>
 #include "wifi.h"
+#include "scheduler.h"
+#include "ota_update.h"
 
 // Add these to your secret_configs.h file
 #ifndef CURRENT_FIRMWARE_VERSION
 #define CURRENT_FIRMWARE_VERSION "1.0.0"
 #endif
 
+#define WIFI_CHECK_INTERVAL 5000      // WiFi link check period
+#define DPS_POLL_INTERVAL 5000        // Provisioning check period while unassigned
+#define STATUS_PRINT_INTERVAL 60000   // Periodic status dump
+#define NETWORK_TASK_STACK 12288      // TLS handshakes need more than the 8 KB loop stack
+#define NETWORK_TASK_PRIORITY 2       // above the log drain task
+#define METHOD_SPREAD_MS 30000        // fleet-wide method calls act within a random delay up to this
+#define METHOD_RESTART_MIN_DELAY 1000 // lets the method response go out first
+
+void printSystemStatus();
+void handleSerialCommands();
+void networkTask(void* param);
+
+// Scheduler task ids
+static int telemetryTaskId = -1;
+static int serialTaskId = -1;
+static int otaTaskId = -1;
+static int cloudTaskId = -1;
+static int restartTaskId = -1;
+static int alertTaskId = -1;
+static int telemetryNowTaskId = -1;
+
+void wifiTask() {
+    // Check WiFi connection and reconnect if needed
+    if (WiFi.status() != WL_CONNECTED) {
+        LOG_WARN("WiFi disconnected, attempting to reconnect...");
+        startWifiConnectionManager();
+    }
+}
+
+void provisioningTask() {
+    // Register or poll DPS while we are still waiting for a hub assignment
+    if (WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+    if (!iotHubClient.isConnected()) {
+        provisioningStep();
+    } else if (!gateway.isProvisioned()) {
+        // Children register once the gateway itself has a hub
+        gateway.provisionStep();
+    }
+}
+
+// Pulls aggregated records off the sensing core even while offline, and
+// whatever the (adaptive or twin-set) telemetry period is
+void sampleDrainTask() {
+    drainSampleQueue();
+}
+
+void telemetryTask() {
+    drainSampleQueue();
+    
+    if (WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+    bool sent = sendTelemetryIfDue();
+    // Link quality, battery and volatility as of the window just handled
+    scheduler.setPeriod(telemetryTaskId, adaptiveInterval.getInterval());
+    if (sent) {
+        gateway.sendTelemetry();
+    } else {
+        // Retry when the backoff and rate limit allow rather than at the next
+        // regular deadline; errors the hub will not recover from just wait for it
+        uint32_t retryDelayMs = iotHubClient.getRetryDelayMs();
+        if (retryDelayMs > 0) {
+            scheduler.runAfter(telemetryTaskId, retryDelayMs);
+        }
+    }
+}
+
+// One message requested through the telemetry direct method; retried until
+// it is sent unless the hub rejects it outright
+void telemetryNowTask() {
+    if (WiFi.status() != WL_CONNECTED || !iotHubClient.isConnected()) {
+        return;
+    }
+    if (!sendTelemetryNow()) {
+        uint32_t retryDelayMs = iotHubClient.getRetryDelayMs();
+        if (retryDelayMs > 0) {
+            scheduler.runAfter(telemetryNowTaskId, retryDelayMs);
+        }
+    }
+}
+
+// The alert lane; woken by the sensing core, independent of the telemetry period
+void alertTask() {
+    if (WiFi.status() != WL_CONNECTED) {
+        // Idle until the next alert when there is nothing to deliver
+        if (alertsPending()) {
+            scheduler.runAfter(alertTaskId, ALERT_RETRY_INTERVAL);
+        }
+        return;
+    }
+    uint32_t retryDelayMs = sendPendingAlerts();
+    if (retryDelayMs > 0) {
+        scheduler.runAfter(alertTaskId, retryDelayMs);
+    }
+}
+
+// Runs on the sensing core as soon as an alert is queued
+void onAlertQueued() {
+    scheduler.runNow(alertTaskId);
+}
+
+void tokenRenewalTask() {
+    // Renewals are spread over the hour, a few signatures per run at most
+    sasTokenCache.refreshDue();
+    if (iotHubClient.isConnected()) {
+        iotHubClient.renewTokenIfExpiring();
+    }
+}
+
+void otaTask() {
+    uint32_t nextStepMs = otaUpdater.step();
+    // Status changes from this step, or from a start/abort since the last run
+    sendFirmwareStatus();
+    if (nextStepMs > 0) {
+        scheduler.runAfter(otaTaskId, nextStepMs);
+    } else if (otaUpdater.getState() == OTA_DONE) {
+        LOG_INFO("Restarting into new firmware...");
+        delay(1000);
+        ESP.restart();
+    }
+}
+
+void cloudTask() {
+    scheduler.runAfter(cloudTaskId, cloudLink.step());
+}
+
+// Runs on the MQTT watcher task as soon as the hub sends something
+void onCloudData() {
+    scheduler.runNow(cloudTaskId);
+}
+
+// Cloud-to-device messages; completed once logged
+bool handleCloudMessage(const C2dMessage& message) {
+    LOG_INFO("C2D message %s (%u bytes)", message.messageId, (unsigned)message.length);
+    LOG_INFO("C2D payload: %s", message.payload);
+    return true;
+}
+
+// Desired properties from the twin; applied values are reported back
+void applyDesiredProperties(JsonObjectConst desired) {
+    JsonVariantConst interval = desired["telemetryInterval"];
+    if (interval.is<uint32_t>()) {
+        uint32_t intervalMs = constrain(interval.as<uint32_t>(), (uint32_t)TELEMETRY_INTERVAL_MIN,
+                                        (uint32_t)TELEMETRY_INTERVAL_MAX);
+        adaptiveInterval.setBaseInterval(intervalMs);
+        scheduler.setPeriod(telemetryTaskId, adaptiveInterval.getInterval());
+        deviceTwin.report("telemetryInterval", (int32_t)intervalMs);
+        LOG_INFO("Telemetry base interval set to %lu ms", (unsigned long)intervalMs);
+    }
+    if (desired["temperatureDeadband"].is<float>()) {
+        telemetryDeadbands.temperature = desired["temperatureDeadband"].as<float>();
+        deviceTwin.report("temperatureDeadband", telemetryDeadbands.temperature);
+    }
+    if (desired["humidityDeadband"].is<float>()) {
+        telemetryDeadbands.humidity = desired["humidityDeadband"].as<float>();
+        deviceTwin.report("humidityDeadband", telemetryDeadbands.humidity);
+    }
+    
+    // Same property as the Node simulator, plus the image digest the OTA path checks
+    JsonObjectConst firmware = desired["firmwareUpdate"].as<JsonObjectConst>();
+    const char* version = firmware["version"].as<const char*>();
+    const char* url = firmware["url"].as<const char*>();
+    const char* sha256 = firmware["sha256"].as<const char*>();
+    if (version && url && sha256 && strcmp(version, CURRENT_FIRMWARE_VERSION) != 0 && !otaUpdater.isActive()) {
+        LOG_INFO("Firmware update requested via twin: %s -> %s", CURRENT_FIRMWARE_VERSION, version);
+        // Runs even if the start failed, to send the status it reported
+        otaUpdater.start(url, sha256, version, firmware["delta"] | false);
+        scheduler.runNow(otaTaskId);
+    }
+}
+
+void restartTask() {
+    LOG_INFO("Restarting device...");
+    delay(500);
+    ESP.restart();
+}
+
+// Direct methods mirroring the serial commands status, telemetry and restart.
+// Ops call them on the whole fleet at once, so telemetry and restart act
+// after a random delay instead of all hitting the hub (and DPS) together.
+uint16_t methodStatus(az_span payload, char* response, size_t responseSize) {
+    snprintf(response, responseSize,
+             "{\"deviceId\":\"%s\",\"firmwareVersion\":\"%s\",\"uptime\":%lu,\"freeHeap\":%lu,"
+             "\"rssi\":%d,\"hubConnected\":%s,\"telemetrySent\":%lu,\"telemetryFailed\":%lu}",
+             AZURE_DEVICE_ID, CURRENT_FIRMWARE_VERSION, millis() / 1000, (unsigned long)ESP.getFreeHeap(),
+             WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0, iotHubClient.isConnected() ? "true" : "false",
+             (unsigned long)telemetrySent.get(), (unsigned long)telemetryFailed.get());
+    return 200;
+}
+
+// {"spreadMs": n} overrides the random delay; 0 sends right away
+uint16_t methodTelemetry(az_span payload, char* response, size_t responseSize) {
+    if (!iotHubClient.isConnected()) {
+        return 503;
+    }
+    uint32_t spreadMs = METHOD_SPREAD_MS;
+    methodArgUint32(payload, AZ_SPAN_FROM_STR("spreadMs"), &spreadMs);
+    uint32_t delayMs = spreadMs > 0 ? random(spreadMs) : 0;
+    scheduler.runAfter(telemetryNowTaskId, delayMs);
+    snprintf(response, responseSize, "{\"sendInMs\":%lu}", (unsigned long)delayMs);
+    return 202;
+}
+
+// {"delayMs": n} restarts after exactly n ms (at least METHOD_RESTART_MIN_DELAY)
+uint16_t methodRestart(az_span payload, char* response, size_t responseSize) {
+    uint32_t delayMs;
+    if (!methodArgUint32(payload, AZ_SPAN_FROM_STR("delayMs"), &delayMs)) {
+        delayMs = random(METHOD_SPREAD_MS);
+    }
+    if (delayMs < METHOD_RESTART_MIN_DELAY) {
+        delayMs = METHOD_RESTART_MIN_DELAY;
+    }
+    scheduler.runAfter(restartTaskId, delayMs);
+    snprintf(response, responseSize, "{\"restartInMs\":%lu}", (unsigned long)delayMs);
+    return 200;
+}
+
+static const DirectMethod methodTable[] = {
+    {AZ_SPAN_LITERAL_FROM_STR("status"), methodStatus},
+    {AZ_SPAN_LITERAL_FROM_STR("telemetry"), methodTelemetry},
+    {AZ_SPAN_LITERAL_FROM_STR("restart"), methodRestart},
+};
+
+void onSerialReceive() {
+    scheduler.runNow(serialTaskId);
+}
+
 void setup() {
     Serial.begin(115200);
     
@@ -19,22 +250,55 @@ void setup() {
     Serial.printf("Region: %s\n", REGION);
     Serial.printf("Device ID: %s\n", AZURE_DEVICE_ID);
     
+    // Log calls only enqueue; this task does the slow UART writes
+    startLogger();
+    
+    // Sampling and aggregation run on their own core from here on
+    startSensingTask();
+    
+    // Everything that touches WiFi, TLS or HTTP runs on the other core
+    xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK, nullptr,
+                            NETWORK_TASK_PRIORITY, nullptr, NETWORK_CORE);
+}
+
+void networkTask(void* param) {
     // Start WiFi connection manager
     startWifiConnectionManager();
+    gateway.begin();
+    
+    // Each task runs at its own deadline instead of a shared 1 s tick
+    scheduler.begin();
+    scheduler.addTask("wifi", wifiTask, WIFI_CHECK_INTERVAL, WIFI_CHECK_INTERVAL);
+    scheduler.addTask("provision", provisioningTask, DPS_POLL_INTERVAL, DPS_POLL_INTERVAL);
+    scheduler.addTask("samples", sampleDrainTask, SAMPLE_DRAIN_INTERVAL, SAMPLE_DRAIN_INTERVAL);
+    telemetryTaskId = scheduler.addTask("telemetry", telemetryTask, TELEMETRY_INTERVAL, TELEMETRY_INTERVAL);
+    scheduler.addTask("token", tokenRenewalTask, TOKEN_CHECK_INTERVAL, TOKEN_CHECK_INTERVAL);
+    scheduler.addTask("status", printSystemStatus, STATUS_PRINT_INTERVAL, STATUS_PRINT_INTERVAL);
+    serialTaskId = scheduler.addTask("serial", handleSerialCommands, 0);
+    otaTaskId = scheduler.addTask("ota", otaTask, 0);
+    cloudTaskId = scheduler.addTask("cloud", cloudTask, CLOUD_LINK_IDLE_INTERVAL, CLOUD_LINK_RETRY_INTERVAL);
+    restartTaskId = scheduler.addTask("restart", restartTask, 0);
+    alertTaskId = scheduler.addTask("alert", alertTask, 0);
+    telemetryNowTaskId = scheduler.addTask("telemetry.now", telemetryNowTask, 0);
+    onSensorAlert(onAlertQueued);
+    scheduler.runNow(alertTaskId);  // anything queued before the lane existed
+    directMethods.setTable(methodTable);
+    cloudLink.onCloudMessage(handleCloudMessage);
+    deviceTwin.onDesired(applyDesiredProperties);
+    deviceTwin.report("firmwareVersion", CURRENT_FIRMWARE_VERSION);
+    deviceTwin.report("telemetryInterval", (int32_t)TELEMETRY_INTERVAL);
+    cloudLink.onData(onCloudData);
+    otaUpdater.onStatus(reportFirmwareStatus);
+    Serial.onReceive(onSerialReceive);
+    
+    for (;;) {
+        scheduler.run();
+    }
 }
 
 void loop() {
-    // Check WiFi connection and reconnect if needed
-    if (WiFi.status() != WL_CONNECTED) {
-        Serial.println("WiFi disconnected, attempting to reconnect...");
-        startWifiConnectionManager();
-    } else {
-        pollDPSAssignment();
-        // WiFi is connected, try to send telemetry if due
-        sendTelemetryIfDue();
-    }
-    
-    delay(1000); // Check every second
+    // The Arduino loop task is not used; sensing and networking have their own tasks
+    vTaskDelete(NULL);
 }
 
 // Optional: Add some utility functions for monitoring
@@ -46,14 +310,28 @@ void printSystemStatus() {
         Serial.printf("SSID: %s\n", WiFi.SSID().c_str());
         Serial.printf("IP: %s\n", WiFi.localIP().toString().c_str());
         Serial.printf("Signal: %d dBm\n", WiFi.RSSI());
+        wifiRssi.set(WiFi.RSSI());
     }
     
     Serial.printf("Free Heap: %d bytes\n", ESP.getFreeHeap());
+    printHeapSummary();
     Serial.printf("Uptime: %lu seconds\n", millis() / 1000);
+    printSensingStats();
     
     // Check if IoT Hub client is connected
     extern AzureIoTHubClient iotHubClient;
     Serial.printf("IoT Hub Status: %s\n", iotHubClient.isConnected() ? "Connected" : "Not Connected");
+    Serial.printf("Auth: %s\n", AZURE_AUTH_X509 ? "X.509 certificate" : "SAS token");
+    hubRetry.printStatus();
+    hubLimiter.printStatus();
+    dpsRetry.printStatus();
+    adaptiveInterval.printStatus();
+    gateway.printStatus();
+    cloudLink.printStatus();
+    sasTokenCache.printStatus();
+    tlsVerifier.printStatus();
+    printTlsMemoryStatus();
+    printMetricsSummary();
     
     time_t now = time(nullptr);
     if (now > 24 * 3600) {
@@ -74,6 +352,13 @@ void handleSerialCommands() {
     if (Serial.available()) {
         String command = Serial.readString();
         command.trim();
+        
+        // Arguments (URLs, hashes) keep their case; only the command is folded
+        int space = command.indexOf(' ');
+        String arguments = space > 0 ? command.substring(space + 1) : String();
+        if (space > 0) {
+            command = command.substring(0, space);
+        }
         command.toLowerCase();
         
         if (command == "status") {
@@ -81,7 +366,8 @@ void handleSerialCommands() {
         } else if (command == "telemetry") {
             extern AzureIoTHubClient iotHubClient;
             if (iotHubClient.isConnected()) {
-                String payload = iotHubClient.createTelemetryPayload();
+                ArenaScope scope(messageArena);
+                const char* payload = iotHubClient.createTelemetryPayload();
                 Serial.println("Sending telemetry on demand...");
                 if (iotHubClient.sendTelemetry(payload)) {
                     Serial.println("Telemetry sent successfully");
@@ -91,6 +377,57 @@ void handleSerialCommands() {
             } else {
                 Serial.println("IoT Hub client not connected");
             }
+        } else if (command == "metrics") {
+            printMetrics();
+        } else if (command == "trace") {
+            printChromeTrace(Serial);
+        } else if (command == "heap") {
+            printHeapStats();
+        } else if (command == "ota") {
+            // ota [delta] <url> <sha256> [version] | ota abort | ota
+            bool delta = arguments.startsWith("delta ");
+            if (delta) {
+                arguments = arguments.substring(6);
+            }
+            int first = arguments.indexOf(' ');
+            if (arguments == "abort") {
+                otaUpdater.abort("aborted by user");
+            } else if (first > 0) {
+                int second = arguments.indexOf(' ', first + 1);
+                String url = arguments.substring(0, first);
+                String sha256 = second > 0 ? arguments.substring(first + 1, second) : arguments.substring(first + 1);
+                String version = second > 0 ? arguments.substring(second + 1) : String("unknown");
+                otaUpdater.start(url.c_str(), sha256.c_str(), version.c_str(), delta);
+            }
+            // Sends any status the start or abort reported
+            scheduler.runNow(otaTaskId);
+            otaUpdater.printStatus();
+        } else if (command == "x509") {
+            // x509 | x509 clear
+            if (arguments == "clear") {
+                // Every TLS handshake to the hub presents these strings;
+                // nothing would load a replacement until a restart
+                if (AZURE_AUTH_X509 && iotHubClient.isConnected()) {
+                    Serial.println("X.509 credentials in use by the hub connection; not cleared");
+                } else {
+                    deviceCredentials.clear();
+                    Serial.println("X.509 credentials removed from NVS");
+                }
+            }
+            deviceCredentials.printStatus();
+        } else if (command == "crypto") {
+            // crypto | crypto bench [iterations] | crypto mbedtls | crypto esp_sha
+            if (arguments.startsWith("bench")) {
+                long iterations = arguments.length() > 6 ? arguments.substring(6).toInt() : 0;
+                runCryptoBenchmark(iterations > 0 ? iterations : 200);
+            } else if (arguments == mbedtlsCrypto.getName()) {
+                setCryptoBackend(mbedtlsCrypto);
+            } else if (arguments == espShaCrypto.getName()) {
+                setCryptoBackend(espShaCrypto);
+            }
+            Serial.printf("Crypto backend: %s\n", getCryptoBackend().getName());
+        } else if (command == "tasks") {
+            scheduler.printStats();
         } else if (command == "restart") {
             Serial.println("Restarting device...");
             ESP.restart();
@@ -98,6 +435,13 @@ void handleSerialCommands() {
             Serial.println("Available commands:");
             Serial.println("  status    - Show system status");
             Serial.println("  telemetry - Send telemetry now");
+            Serial.println("  metrics   - Show counters and latency histograms");
+            Serial.println("  trace     - Dump recent requests as Chrome trace JSON");
+            Serial.println("  heap      - Show heap usage by subsystem and allocation site");
+            Serial.println("  ota       - ota [delta] <url> <sha256> [version] | ota abort | ota (progress)");
+            Serial.println("  x509      - Show the device certificate | x509 clear");
+            Serial.println("  crypto    - crypto bench [n] | crypto mbedtls | crypto esp_sha");
+            Serial.println("  tasks     - Show scheduler task timing");
             Serial.println("  restart   - Restart device");
             Serial.println("  help      - Show this help");
         }
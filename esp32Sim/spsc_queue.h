@@ -0,0 +1,69 @@
+// spsc_queue.h file - Lock-free single-producer/single-consumer ring buffer
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Fixed-capacity ring of trivially copyable records. Exactly one task may
+// push and exactly one (other) task may pop; no locks or critical sections
+// are taken, so the producer never blocks behind the consumer. When full,
+// push() drops the new record and counts an overflow.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0), pushed(0), overflows(0), highWater(0) {}
+
+    // Producer side
+    bool push(const T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t t = tail.load(std::memory_order_acquire);
+        if (h - t >= Capacity) {
+            overflows.store(overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        slots[h & (Capacity - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+
+        pushed.store(pushed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        uint32_t occupancy = h + 1 - t;
+        if (occupancy > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(occupancy, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t h = head.load(std::memory_order_acquire);
+        if (t == h) {
+            return false;
+        }
+
+        item = slots[t & (Capacity - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side; a snapshot that may be stale by the time it is used
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return Capacity; }
+    uint32_t getPushed() const { return pushed.load(std::memory_order_relaxed); }
+    uint32_t getOverflows() const { return overflows.load(std::memory_order_relaxed); }
+    uint32_t getHighWater() const { return highWater.load(std::memory_order_relaxed); }
+
+private:
+    T slots[Capacity];
+    std::atomic<uint32_t> head;       // written by the producer only
+    std::atomic<uint32_t> tail;       // written by the consumer only
+    std::atomic<uint32_t> pushed;     // producer-owned counters
+    std::atomic<uint32_t> overflows;
+    std::atomic<uint32_t> highWater;
+};
@@ -0,0 +1,82 @@
+// tls_client.cpp file - WiFiClientSecure with a low-memory TLS record profile
+#include <esp_heap_caps.h>
+#include <mbedtls/ssl.h>
+
+#include "tls_client.h"
+#include "logger.h"
+#include "metrics.h"
+
+#define TLS_FULL_RECORD_LENGTH 16384
+
+static Histogram tlsHeapFullBytes("tls.heap_full_records_bytes");
+static Histogram tlsHeapReducedBytes("tls.heap_reduced_records_bytes");
+static Counter tlsFragmentRejected("tls.mfl_not_negotiated");
+
+TlsClient::TlsClient() : heapBeforeConnect(0) {}
+
+void TlsClient::requestMaxFragmentLength() {
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH) && TLS_MAX_FRAGMENT_LENGTH > 0
+    unsigned char code = TLS_MAX_FRAGMENT_LENGTH <= 512    ? MBEDTLS_SSL_MAX_FRAG_LEN_512
+                         : TLS_MAX_FRAGMENT_LENGTH <= 1024 ? MBEDTLS_SSL_MAX_FRAG_LEN_1024
+                         : TLS_MAX_FRAGMENT_LENGTH <= 2048 ? MBEDTLS_SSL_MAX_FRAG_LEN_2048
+                                                           : MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+    // stop() frees the config, so this is applied on every connect;
+    // mbedtls_ssl_config_defaults() leaves the setting alone
+    mbedtls_ssl_conf_max_frag_len(&sslclient->ssl_conf, code);
+#endif
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port) {
+    heapBeforeConnect = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    requestMaxFragmentLength();
+    return WiFiClientSecure::connect(ip, port);
+}
+
+int TlsClient::connect(const char* host, uint16_t port) {
+    heapBeforeConnect = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    requestMaxFragmentLength();
+    return WiFiClientSecure::connect(host, port);
+}
+
+bool TlsClient::startTLS() {
+    if (!WiFiClientSecure::startTLS()) {
+        return false;
+    }
+    recordFootprint();
+    return true;
+}
+
+size_t TlsClient::getMaxFragmentLength() {
+#ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+    return mbedtls_ssl_get_output_max_frag_len(&sslclient->ssl_ctx);
+#else
+    return TLS_FULL_RECORD_LENGTH;
+#endif
+}
+
+void TlsClient::recordFootprint() {
+    size_t heapNow = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    uint32_t footprint = heapBeforeConnect > heapNow ? heapBeforeConnect - heapNow : 0;
+    size_t fragment = getMaxFragmentLength();
+
+    if (fragment < TLS_FULL_RECORD_LENGTH) {
+        tlsHeapReducedBytes.record(footprint);
+    } else {
+        tlsHeapFullBytes.record(footprint);
+        if (TLS_MAX_FRAGMENT_LENGTH > 0) {
+            tlsFragmentRejected.inc();
+        }
+    }
+    LOG_DEBUG("TLS connection holds %u bytes (%u byte records)", footprint, fragment);
+}
+
+void printTlsMemoryStatus() {
+    Serial.printf("TLS records: %u requested", (unsigned)(TLS_MAX_FRAGMENT_LENGTH > 0 ? TLS_MAX_FRAGMENT_LENGTH : TLS_FULL_RECORD_LENGTH));
+    if (tlsHeapReducedBytes.getCount() > 0) {
+        Serial.printf(", peak heap per connection %lu bytes reduced", (unsigned long)tlsHeapReducedBytes.getMax());
+    }
+    if (tlsHeapFullBytes.getCount() > 0) {
+        Serial.printf(", %lu bytes full-size", (unsigned long)tlsHeapFullBytes.getMax());
+    }
+    Serial.println();
+}
@@ -0,0 +1,48 @@
+// tls_client.h file - WiFiClientSecure with a low-memory TLS record profile
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+
+#include "secret_configs.h"
+
+// Largest TLS record the device asks the server to send (RFC 6066 max
+// fragment length): 512, 1024, 2048 or 4096, or 0 for the standard 16 KB.
+// Override in secret_configs.h. Servers that do not support the extension
+// ignore it and the connection falls back to full-size records.
+#ifndef TLS_MAX_FRAGMENT_LENGTH
+#define TLS_MAX_FRAGMENT_LENGTH 2048
+#endif
+
+// WiFiClientSecure that requests TLS_MAX_FRAGMENT_LENGTH records and
+// measures the heap each connection holds once the handshake is done.
+//
+// The saving needs mbedTLS buffers sized from the negotiated length
+// (CONFIG_MBEDTLS_DYNAMIC_BUFFER or MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH);
+// with fixed buffers the negotiation succeeds but the footprint stays at
+// MBEDTLS_SSL_IN_CONTENT_LEN + MBEDTLS_SSL_OUT_CONTENT_LEN, which the
+// histograms make visible. Reaches into the Arduino client's mbedTLS
+// config, so it depends on that library's sslclient_context layout.
+class TlsClient : public WiFiClientSecure {
+public:
+    TlsClient();
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    bool startTLS();
+
+    // Record payload size both sides agreed on; 16384 when not reduced
+    size_t getMaxFragmentLength();
+
+    // Underlying socket for select(); -1 when not connected
+    int getSocket() const { return sslclient ? sslclient->socket : -1; }
+
+private:
+    size_t heapBeforeConnect;
+
+    void requestMaxFragmentLength();
+    void recordFootprint();
+};
+
+// Heap held per connection, split by whether reduced records were agreed
+void printTlsMemoryStatus();
@@ -0,0 +1,182 @@
+// tls_verify.cpp file - Server certificate validation with a verification cache
+#include "tls_verify.h"
+#include "logger.h"
+#include "metrics.h"
+
+TlsVerifier tlsVerifier;
+
+static Counter tlsCacheHits("tls.cache_hits");
+static Counter tlsCacheMisses("tls.cache_misses");
+static Counter tlsFingerprintMismatches("tls.fingerprint_mismatches");
+static Histogram tlsFullHandshakeUs("tls.handshake_full_us");
+static Histogram tlsCachedHandshakeUs("tls.handshake_cached_us");
+
+const char azureRootCertificates[] = R"PEM(
+-----BEGIN CERTIFICATE-----
+MIIDjjCCAnagAwIBAgIQAzrx5qcRqaC7KGSxHQn65TANBgkqhkiG9w0BAQsFADBh
+MQswCQYDVQQGEwJVUzEVMBMGA1UEChMMRGlnaUNlcnQgSW5jMRkwFwYDVQQLExB3
+d3cuZGlnaWNlcnQuY29tMSAwHgYDVQQDExdEaWdpQ2VydCBHbG9iYWwgUm9vdCBH
+MjAeFw0xMzA4MDExMjAwMDBaFw0zODAxMTUxMjAwMDBaMGExCzAJBgNVBAYTAlVT
+MRUwEwYDVQQKEwxEaWdpQ2VydCBJbmMxGTAXBgNVBAsTEHd3dy5kaWdpY2VydC5j
+b20xIDAeBgNVBAMTF0RpZ2lDZXJ0IEdsb2JhbCBSb290IEcyMIIBIjANBgkqhkiG
+9w0BAQEFAAOCAQ8AMIIBCgKCAQEAuzfNNNx7a8myaJCtSnX/RrohCgiN9RlUyfuI
+2/Ou8jqJkTx65qsGGmvPrC3oXgkkRLpimn7Wo6h+4FR1IAWsULecYxpsMNzaHxmx
+1x7e/dfgy5SDN67sH0NO3Xss0r0upS/kqbitOtSZpLYl6ZtrAGCSYP9PIUkY92eQ
+q2EGnI/yuum06ZIya7XzV+hdG82MHauVBJVJ8zUtluNJbd134/tJS7SsVQepj5Wz
+tCO7TG1F8PapspUwtP1MVYwnSlcUfIKdzXOS0xZKBgyMUNGPHgm+F6HmIcr9g+UQ
+vIOlCsRnKPZzFBQ9RnbDhxSJITRNrw9FDKZJobq7nMWxM4MphQIDAQABo0IwQDAP
+BgNVHRMBAf8EBTADAQH/MA4GA1UdDwEB/wQEAwIBhjAdBgNVHQ4EFgQUTiJUIBiV
+5uNu5g/6+rkS7QYXjzkwDQYJKoZIhvcNAQELBQADggEBAGBnKJRvDkhj6zHd6mcY
+1Yl9PMWLSn/pvtsrF9+wX3N3KjITOYFnQoQj8kVnNeyIv/iPsGEMNKSuIEyExtv4
+NeF22d+mQrvHRAiGfzZ0JFrabA0UWTW98kndth/Jsw1HKj2ZL7tcu7XUIOGZX1NG
+Fdtom/DzMNU+MeKNhJ7jitralj41E6Vf8PlwUHBHQRFXGU7Aj64GxJUTFy8bJZ91
+8rGOmaFvE7FBcf6IKshPECBV1/MUReXgRPTqh5Uykw7+U0b6LJ3/iyK5S9kJRaTe
+pLiaWN0bfVKfjllDiIGknibVb63dDcY3fe0Dkhvld1927jyNxF1WW6LZZm6zNTfl
+MrY=
+-----END CERTIFICATE-----
+-----BEGIN CERTIFICATE-----
+MIIFqDCCA5CgAwIBAgIQHtOXCV/YtLNHcB6qvn9FszANBgkqhkiG9w0BAQwFADBl
+MQswCQYDVQQGEwJVUzEeMBwGA1UEChMVTWljcm9zb2Z0IENvcnBvcmF0aW9uMTYw
+NAYDVQQDEy1NaWNyb3NvZnQgUlNBIFJvb3QgQ2VydGlmaWNhdGUgQXV0aG9yaXR5
+IDIwMTcwHhcNMTkxMjE4MjI1MTIyWhcNNDIwNzE4MjMwMDIzWjBlMQswCQYDVQQG
+EwJVUzEeMBwGA1UEChMVTWljcm9zb2Z0IENvcnBvcmF0aW9uMTYwNAYDVQQDEy1N
+aWNyb3NvZnQgUlNBIFJvb3QgQ2VydGlmaWNhdGUgQXV0aG9yaXR5IDIwMTcwggIi
+MA0GCSqGSIb3DQEBAQUAA4ICDwAwggIKAoICAQDKW76UM4wplZEWCpW9R2LBifOZ
+Nt9GkMml7Xhqb0eRaPgnZ1AzHaGm++DlQ6OEAlcBXZxIQIJTELy/xztokLaCLeX0
+ZdDMbRnMlfl7rEqUrQ7eS0MdhweSE5CAg2Q1OQT85elss7YfUJQ4ZVBcF0a5toW1
+HLUX6NZFndiyJrDKxHBKrmCk3bPZ7Pw71VdyvD/IybLeS2v4I2wDwAW9lcfNcztm
+gGTjGqwu+UcF8ga2m3P1eDNbx6H7JyqhtJqRjJHTOoI+dkC0zVJhUXAoP8XFWvLJ
+jEm7FFtNyP9nTUwSlq31/niol4fX/V4ggNyhSyL71Imtus5Hl0dVe49FyGcohJUc
+aDDv70ngNXtk55iwlNpNhTs+VcQor1fznhPbRiefHqJeRIOkpcrVE7NLP8TjwuaG
+YaRSMLl6IE9vDzhTyzMMEyuP1pq9KsgtsRx9S1HKR9FIJ3Jdh+vVReZIZZ2vUpC6
+W6IYZVcSn2i51BVrlMRpIpj0M+Dt+VGOQVDJNE92kKz8OMHY4Xu54+OU4UZpyw4K
+UGsTuqwPN1q3ErWQgR5WrlcihtnJ0tHXUeOrO8ZV/R4O03QK0dqq6mm4lyiPSMQH
++FJDOvTKVTUssKZqwJz58oHhEmrARdlns87/I6KJClTUFLkqqNfs+avNJVgyeY+Q
+W5g5xAgGwax/Dj0ApQIDAQABo1QwUjAOBgNVHQ8BAf8EBAMCAYYwDwYDVR0TAQH/
+BAUwAwEB/zAdBgNVHQ4EFgQUCctZf4aycI8awznjwNnpv7tNsiMwEAYJKwYBBAGC
+NxUBBAMCAQAwDQYJKoZIhvcNAQEMBQADggIBAKyvPl3CEZaJjqPnktaXFbgToqZC
+LgLNFgVZJ8og6Lq46BrsTaiXVq5lQ7GPAJtSzVXNUzltYkyLDVt8LkS/gxCP81OC
+gMNPOsduET/m4xaRhPtthH80dK2Jp86519efhGSSvpWhrQlTM93uCupKUY5vVau6
+tZRGrox/2KJQJWVggEbbMwSubLWYdFQl3JPk+ONVFT24bcMKpBLBaYVu32TxU5nh
+SnUgnZUP5NbcA/FZGOhHibJXWpS2qdgXKxdJ5XbLwVaZOjex/2kskZGT4d9Mozd2
+TaGf+G0eHdP67Pv0RR0Tbc/3WeUiJ3IrhvNXuzDtJE3cfVa7o7P4NHmJweDyAmH3
+pvwPuxwXC65B2Xy9J6P9LjrRk5Sxcx0ki69bIImtt2dmefU6xqaWM/5TkshGsRGR
+xpl/j8nWZjEgQRCHLQzWwa80mMpkg/sTV9HB8Dx6jKXB/ZUhoHHBk2dxEuqPiApp
+GWSZI1b7rCoucL5mxAyE7+WL85MB+GqQk2dLsmijtWKP6T+MejteD+eMuMZ87zf9
+dOLITzNy4ZQ5bb0Sr74MTnB8G2+NszKTc0QWbej09+CVgI+WXTik9KveCjCHk9hN
+AHFiRSdLOkKEW39lt2c0Ui2cFmuqqNh7o0JMcccMyj6D5KbvtwEwXlGjefVwaaZB
+RA+GsCyRxj3qrg+E
+-----END CERTIFICATE-----
+)PEM";
+
+TlsVerifier::TlsVerifier() {
+    memset(entries, 0, sizeof(entries));
+}
+
+TlsVerifier::Entry* TlsVerifier::find(const char* host) {
+    for (int i = 0; i < TLS_VERIFY_CACHE_SIZE; i++) {
+        if (entries[i].host[0] && strcmp(entries[i].host, host) == 0) {
+            return &entries[i];
+        }
+    }
+    return nullptr;
+}
+
+void TlsVerifier::store(const char* host, const uint8_t fingerprint[32]) {
+    // Reuse the host's entry, else a free one, else the oldest
+    Entry* entry = find(host);
+    for (int i = 0; entry == nullptr && i < TLS_VERIFY_CACHE_SIZE; i++) {
+        if (!entries[i].host[0]) entry = &entries[i];
+    }
+    if (entry == nullptr) {
+        entry = &entries[0];
+        for (int i = 1; i < TLS_VERIFY_CACHE_SIZE; i++) {
+            if (millis() - entries[i].verifiedAt > millis() - entry->verifiedAt) entry = &entries[i];
+        }
+    }
+
+    snprintf(entry->host, sizeof(entry->host), "%s", host);
+    memcpy(entry->fingerprint, fingerprint, sizeof(entry->fingerprint));
+    entry->verifiedAt = millis();
+    entry->hits = 0;
+}
+
+void TlsVerifier::invalidate(const char* host) {
+    Entry* entry = find(host);
+    if (entry != nullptr) {
+        memset(entry, 0, sizeof(*entry));
+    }
+}
+
+bool TlsVerifier::configure(WiFiClientSecure& client, const char* host) {
+#if TLS_VERIFY_MODE == TLS_VERIFY_NONE
+    client.setInsecure();
+    return false;
+#else
+#if TLS_VERIFY_MODE == TLS_VERIFY_CACHED
+    Entry* entry = find(host);
+    if (entry != nullptr && millis() - entry->verifiedAt < TLS_VERIFY_CACHE_TTL) {
+        // The certificate is checked by fingerprint once the handshake is done
+        client.setInsecure();
+        return true;
+    }
+#endif
+    client.setCACert(azureRootCertificates);
+    return false;
+#endif
+}
+
+bool TlsVerifier::checkPeer(WiFiClientSecure& client, const char* host, bool cached, uint32_t handshakeUs) {
+#if TLS_VERIFY_MODE == TLS_VERIFY_NONE
+    return true;
+#else
+    uint8_t fingerprint[32];
+    if (!client.getFingerprintSHA256(fingerprint)) {
+        LOG_ERROR("No server certificate from %s", host);
+        invalidate(host);
+        return false;
+    }
+
+    if (cached) {
+        Entry* entry = find(host);
+        if (entry == nullptr || memcmp(entry->fingerprint, fingerprint, sizeof(fingerprint)) != 0) {
+            LOG_WARN("Certificate for %s changed; validating it on the next connection", host);
+            tlsFingerprintMismatches.inc();
+            invalidate(host);
+            return false;
+        }
+        entry->hits++;
+        tlsCacheHits.inc();
+        tlsCachedHandshakeUs.record(handshakeUs);
+        return true;
+    }
+
+    // mbedTLS validated the chain and host name during the handshake
+    tlsCacheMisses.inc();
+    tlsFullHandshakeUs.record(handshakeUs);
+#if TLS_VERIFY_MODE == TLS_VERIFY_CACHED
+    store(host, fingerprint);
+#endif
+    return true;
+#endif
+}
+
+void TlsVerifier::printStatus() {
+    static const char* const modeNames[] = {"none (insecure)", "full", "cached"};
+    Serial.printf("TLS verify: %s", modeNames[TLS_VERIFY_MODE]);
+    if (tlsFullHandshakeUs.getCount() > 0) {
+        Serial.printf(", handshake p50 full %lu us", (unsigned long)tlsFullHandshakeUs.percentile(0.5f));
+    }
+    if (tlsCachedHandshakeUs.getCount() > 0) {
+        Serial.printf(", cached %lu us", (unsigned long)tlsCachedHandshakeUs.percentile(0.5f));
+    }
+    Serial.println();
+
+    for (int i = 0; i < TLS_VERIFY_CACHE_SIZE; i++) {
+        const Entry& entry = entries[i];
+        if (!entry.host[0]) continue;
+        Serial.printf("  %s: %02x%02x%02x%02x..., verified %lu s ago, %lu hits\n", entry.host,
+                      entry.fingerprint[0], entry.fingerprint[1], entry.fingerprint[2], entry.fingerprint[3],
+                      (millis() - entry.verifiedAt) / 1000, (unsigned long)entry.hits);
+    }
+}
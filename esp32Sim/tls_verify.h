@@ -0,0 +1,61 @@
+// tls_verify.h file - Server certificate validation with a verification cache
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+
+#include "secret_configs.h"
+
+#define TLS_VERIFY_NONE 0    // no validation; development against local servers only
+#define TLS_VERIFY_FULL 1    // chain validated against the root bundle on every handshake
+#define TLS_VERIFY_CACHED 2  // full validation once per server certificate, then a fingerprint match
+
+// Override in secret_configs.h
+#ifndef TLS_VERIFY_MODE
+#define TLS_VERIFY_MODE TLS_VERIFY_CACHED
+#endif
+
+#define TLS_VERIFY_CACHE_SIZE 4           // hosts remembered (DPS, hub, OTA)
+#define TLS_VERIFY_CACHE_TTL 86400000UL   // ms before a cached certificate is validated again
+
+// Roots the Azure endpoints chain to: DigiCert Global Root G2 (DPS, IoT Hub,
+// Blob Storage) and Microsoft RSA Root Certificate Authority 2017 (the
+// documented successor)
+extern const char azureRootCertificates[];
+
+// Chain validation costs several RSA signature checks per handshake. Once a
+// host's certificate has passed it, later handshakes to that host skip the
+// chain and compare the SHA-256 fingerprint of the presented certificate
+// instead; a different certificate (e.g. after rotation) drops the entry,
+// fails that connection and is fully validated on the next one.
+// Network task only.
+class TlsVerifier {
+public:
+    TlsVerifier();
+
+    // Before the handshake. Returns true when the host is cached and
+    // checkPeer() must match the fingerprint after it.
+    bool configure(WiFiClientSecure& client, const char* host);
+
+    // After a successful handshake; false means the connection must be
+    // dropped. handshakeUs feeds the full/cached cost histograms.
+    bool checkPeer(WiFiClientSecure& client, const char* host, bool cached, uint32_t handshakeUs);
+
+    void invalidate(const char* host);
+    void printStatus();
+
+private:
+    struct Entry {
+        char host[64];
+        uint8_t fingerprint[32];
+        uint32_t verifiedAt;   // millis() of the full validation
+        uint32_t hits;
+    };
+
+    Entry entries[TLS_VERIFY_CACHE_SIZE];
+
+    Entry* find(const char* host);
+    void store(const char* host, const uint8_t fingerprint[32]);
+};
+
+extern TlsVerifier tlsVerifier;
@@ -0,0 +1,71 @@
+// x509_credentials.cpp file - Device certificate and key kept in NVS
+#include <Preferences.h>
+
+#include "x509_credentials.h"
+#include "logger.h"
+#include "secret_configs.h"
+
+X509Credentials deviceCredentials;
+
+bool X509Credentials::load() {
+    Preferences nvs;
+    if (!nvs.begin(X509_NVS_NAMESPACE, true)) {
+        // Namespace does not exist yet; nothing stored
+        certificate = "";
+        privateKey = "";
+    } else {
+        certificate = nvs.getString("cert", "");
+        privateKey = nvs.getString("key", "");
+        nvs.end();
+    }
+
+#if defined(AZURE_X509_CERT_PEM) && defined(AZURE_X509_KEY_PEM)
+    if (!isLoaded()) {
+        LOG_INFO("Seeding X.509 credentials into NVS from the build");
+        store(AZURE_X509_CERT_PEM, AZURE_X509_KEY_PEM);
+    }
+#endif
+
+    if (!isLoaded()) {
+        LOG_ERROR("No X.509 certificate and key in NVS");
+        return false;
+    }
+    LOG_INFO("X.509 credentials loaded (%u byte certificate)", certificate.length());
+    return true;
+}
+
+bool X509Credentials::store(const char* certificatePem, const char* privateKeyPem) {
+    Preferences nvs;
+    if (!nvs.begin(X509_NVS_NAMESPACE, false)) {
+        LOG_ERROR("Failed to open NVS namespace %s", X509_NVS_NAMESPACE);
+        return false;
+    }
+    bool ok = nvs.putString("cert", certificatePem) > 0 && nvs.putString("key", privateKeyPem) > 0;
+    nvs.end();
+
+    if (!ok) {
+        LOG_ERROR("Failed to write X.509 credentials to NVS");
+        return false;
+    }
+    certificate = certificatePem;
+    privateKey = privateKeyPem;
+    return true;
+}
+
+void X509Credentials::clear() {
+    Preferences nvs;
+    if (nvs.begin(X509_NVS_NAMESPACE, false)) {
+        nvs.clear();
+        nvs.end();
+    }
+    certificate = "";
+    privateKey = "";
+}
+
+void X509Credentials::printStatus() {
+    if (!isLoaded()) {
+        Serial.println("X.509: no credentials");
+        return;
+    }
+    Serial.printf("X.509: %u byte certificate, %u byte key\n", certificate.length(), privateKey.length());
+}
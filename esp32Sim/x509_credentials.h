@@ -0,0 +1,32 @@
+// x509_credentials.h file - Device certificate and key kept in NVS
+#pragma once
+
+#include <Arduino.h>
+
+#define X509_NVS_NAMESPACE "azure-x509"
+
+// The device certificate and private key (PEM) used for X.509 auth with
+// DPS and the hub. They live in NVS, so a firmware image built without
+// AZURE_X509_CERT_PEM / AZURE_X509_KEY_PEM carries no key material; when
+// those are set in secret_configs.h they are compiled in and seed NVS on
+// first boot. Loaded once and kept for the TLS stack,
+// which needs both strings for the lifetime of each connection.
+class X509Credentials {
+public:
+    // Reads NVS (seeding it from the build if empty); false if no pair
+    bool load();
+    bool store(const char* certificatePem, const char* privateKeyPem);
+    void clear();
+
+    bool isLoaded() const { return certificate.length() > 0 && privateKey.length() > 0; }
+    const char* getCertificate() const { return certificate.c_str(); }
+    const char* getPrivateKey() const { return privateKey.c_str(); }
+
+    void printStatus();
+
+private:
+    String certificate;
+    String privateKey;
+};
+
+extern X509Credentials deviceCredentials;
@@ -0,0 +1,64 @@
+'use strict';
+
+// Signing throughput on the host: SAS tokens and enrollment group key
+// derivations per second through Node's crypto (OpenSSL, which uses the
+// SHA extensions when the CPU has them). The ESP32 counterpart is the
+// sketch's `crypto bench` command.
+//
+// Usage: node bench-crypto.js [iterations]
+
+const crypto = require('crypto');
+const fs = require('fs');
+
+const iterations = parseInt(process.argv[2] || '200000', 10);
+const groupKey = crypto.randomBytes(64).toString('base64');
+const deviceKey = crypto.randomBytes(32).toString('base64');
+const resourceUri = 'benchmark.azure-devices.net/devices/SimulatedESP32-000';
+
+function cpuHasShaExtensions() {
+  try {
+    return /\bsha_ni\b|\bsha2\b/.test(fs.readFileSync('/proc/cpuinfo', 'utf8'));
+  } catch (err) {
+    return undefined;
+  }
+}
+
+// Same token format as the device SDK and the sketch's azureSASTokenGenerator
+function sasToken(key, expiry) {
+  const encodedUri = encodeURIComponent(resourceUri);
+  const signature = crypto.createHmac('sha256', key).update(`${encodedUri}\n${expiry}`).digest('base64');
+  return `SharedAccessSignature sr=${encodedUri}&sig=${encodeURIComponent(signature)}&se=${expiry}`;
+}
+
+function run(name, fn) {
+  fn(Math.min(iterations, 1000)); // warm up
+  const start = process.hrtime.bigint();
+  fn(iterations);
+  const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+  console.log(`  ${name.padEnd(34)} ${Math.round(iterations / seconds).toString().padStart(10)}/s`);
+}
+
+console.log(`Node ${process.versions.node}, OpenSSL ${process.versions.openssl}, ` +
+            `SHA extensions: ${cpuHasShaExtensions() === undefined ? 'unknown' : cpuHasShaExtensions() ? 'yes' : 'no'}`);
+console.log(`${iterations} iterations each`);
+
+const expiry = Math.floor(Date.now() / 1000) + 3600;
+run('tokens (key decoded per token)', (n) => {
+  for (let i = 0; i < n; i++) sasToken(Buffer.from(deviceKey, 'base64'), expiry + i);
+});
+const deviceKeyBytes = Buffer.from(deviceKey, 'base64');
+run('tokens (key decoded once)', (n) => {
+  for (let i = 0; i < n; i++) sasToken(deviceKeyBytes, expiry + i);
+});
+
+run('derivations (key decoded per id)', (n) => {
+  for (let i = 0; i < n; i++) {
+    crypto.createHmac('sha256', Buffer.from(groupKey, 'base64')).update(`SimulatedESP32-${i}`).digest('base64');
+  }
+});
+const groupKeyBytes = Buffer.from(groupKey, 'base64');
+run('derivations (key decoded once)', (n) => {
+  for (let i = 0; i < n; i++) {
+    crypto.createHmac('sha256', groupKeyBytes).update(`SimulatedESP32-${i}`).digest('base64');
+  }
+});
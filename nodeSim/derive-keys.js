@@ -0,0 +1,156 @@
+'use strict';
+
+// Derives the device keys of a simulated fleet from one enrollment group key
+// (base64(HMAC-SHA256(groupKey, deviceId)), the same derivation as
+// deriveDeviceKey in the simulators and the ESP32 sketch) and streams
+// "deviceId,deviceKey" lines to a file, in input order.
+//
+// Usage:
+//   node derive-keys.js <groupKey> --count 100000 [--prefix SimulatedESP32-] [--start 0] [--pad 3]
+//   node derive-keys.js <groupKey> --ids ids.txt
+//   options: --out keys.csv (default stdout), --threads N (default: CPU count)
+//
+// Ids are cut into batches that worker threads derive in parallel; each
+// worker decodes the group key once.
+
+const crypto = require('crypto');
+const fs = require('fs');
+const os = require('os');
+const { Worker, isMainThread, parentPort, workerData } = require('worker_threads');
+
+const BATCH_SIZE = 2000;
+
+if (!isMainThread) {
+  const key = Buffer.from(workerData.groupKey, 'base64');
+  parentPort.on('message', ({ batch, ids }) => {
+    let lines = '';
+    for (const id of ids) {
+      lines += `${id},${crypto.createHmac('sha256', key).update(id).digest('base64')}\n`;
+    }
+    parentPort.postMessage({ batch, lines });
+  });
+  return;
+}
+
+function parseArgs(argv) {
+  const options = { prefix: 'SimulatedESP32-', start: 0, pad: 3, threads: os.cpus().length };
+  const positional = [];
+  for (let i = 0; i < argv.length; i++) {
+    if (argv[i].startsWith('--')) {
+      options[argv[i].slice(2)] = argv[++i];
+    } else {
+      positional.push(argv[i]);
+    }
+  }
+  options.groupKey = positional[0];
+  options.start = parseInt(options.start, 10);
+  options.pad = parseInt(options.pad, 10);
+  options.threads = Math.max(1, parseInt(options.threads, 10));
+  if (options.count !== undefined) options.count = parseInt(options.count, 10);
+  return options;
+}
+
+// Yields batches of ids without holding the whole fleet in memory
+function* idBatches(options) {
+  if (options.ids) {
+    const ids = fs.readFileSync(options.ids, 'utf8').split(/\r?\n/).filter((id) => id.length > 0);
+    for (let i = 0; i < ids.length; i += BATCH_SIZE) {
+      yield ids.slice(i, i + BATCH_SIZE);
+    }
+    return;
+  }
+  const end = options.start + options.count;
+  for (let first = options.start; first < end; first += BATCH_SIZE) {
+    const ids = [];
+    for (let n = first; n < Math.min(first + BATCH_SIZE, end); n++) {
+      ids.push(options.prefix + n.toString().padStart(options.pad, '0'));
+    }
+    yield ids;
+  }
+}
+
+function main() {
+  const options = parseArgs(process.argv.slice(2));
+  if (!options.groupKey || (options.ids === undefined && !(options.count > 0))) {
+    console.error('Usage: node derive-keys.js <groupKey> (--count N [--prefix P] [--start S] [--pad W] | --ids file) [--out file] [--threads N]');
+    process.exit(1);
+  }
+
+  const out = options.out ? fs.createWriteStream(options.out) : process.stdout;
+  const batches = idBatches(options);
+  const finished = new Map();   // batch number -> lines, until it can be written in order
+  let nextBatch = 0;            // next batch to hand out
+  let nextWrite = 0;            // next batch to write
+  let derived = 0;
+  let waitingForDrain = false;
+  const idle = [];
+  const startTime = process.hrtime.bigint();
+
+  const workers = [];
+  for (let i = 0; i < options.threads; i++) {
+    const worker = new Worker(__filename, { workerData: { groupKey: options.groupKey } });
+    worker.on('message', ({ batch, lines }) => {
+      finished.set(batch, lines);
+      idle.push(worker);
+      flush();
+      dispatch();
+    });
+    worker.on('error', (err) => {
+      console.error(err);
+      process.exit(1);
+    });
+    workers.push(worker);
+    idle.push(worker);
+  }
+
+  let exhausted = false;
+  function dispatch() {
+    // Bound the reorder buffer so a slow output does not queue the whole fleet
+    while (!exhausted && idle.length > 0 && finished.size < options.threads * 4) {
+      const next = batches.next();
+      if (next.done) {
+        exhausted = true;
+        break;
+      }
+      idle.pop().postMessage({ batch: nextBatch++, ids: next.value });
+    }
+    if (exhausted && nextWrite === nextBatch) {
+      done();
+    }
+  }
+
+  function flush() {
+    while (!waitingForDrain && finished.has(nextWrite)) {
+      const lines = finished.get(nextWrite);
+      finished.delete(nextWrite++);
+      derived += lines.length === 0 ? 0 : lines.split('\n').length - 1;
+      if (!out.write(lines)) {
+        waitingForDrain = true;
+        out.once('drain', () => {
+          waitingForDrain = false;
+          flush();
+          dispatch();
+        });
+      }
+    }
+  }
+
+  let completed = false;
+  function done() {
+    if (completed) return;
+    completed = true;
+    workers.forEach((worker) => worker.terminate());
+    const seconds = Number(process.hrtime.bigint() - startTime) / 1e9;
+    const report = () => console.error(`Derived ${derived} keys in ${seconds.toFixed(2)} s ` +
+                                       `(${Math.round(derived / seconds)}/s, ${options.threads} threads)`);
+    if (out === process.stdout) {
+      report();
+    } else {
+      out.end(report);
+    }
+  }
+
+  dispatch();
+}
+
+main();
@@ -0,0 +1,203 @@
+'use strict';
+
+// Builds a delta patch that turns one firmware image into another, for the
+// ESP32 sketch's `ota delta` command (esp32Sim/delta_patch.h describes the
+// format). Usage: node make-delta.js <old.bin> <new.bin> <out.patch>
+
+const crypto = require('crypto');
+const fs = require('fs');
+
+const MAGIC = 'ESPD';
+const FORMAT_VERSION = 1;
+const FLAG_LZSS = 0x01;
+
+const OP_END = 0x00;
+const OP_COPY = 0x01;
+const OP_LITERAL = 0x02;
+
+const MIN_COPY = 16;           // shorter matches are cheaper as literals
+const HASH_BYTES = 8;
+const HASH_BITS = 20;
+
+// Must match the device decoder
+const WINDOW_SIZE = 4096;
+const MIN_MATCH = 3;
+const MAX_MATCH = 18;
+const MAX_CHAIN = 64;
+
+function writeVarint(out, value) {
+  while (value >= 0x80) {
+    out.push((value & 0x7f) | 0x80);
+    value >>>= 7;
+  }
+  out.push(value);
+}
+
+function zigzag(value) {
+  return value >= 0 ? value * 2 : -value * 2 - 1;
+}
+
+function hashAt(buf, pos) {
+  let h = 0;
+  for (let i = 0; i < HASH_BYTES; i++) {
+    h = Math.imul(h ^ buf[pos + i], 0x9e3779b1);
+  }
+  return h >>> (32 - HASH_BITS);
+}
+
+function matchLength(a, aPos, b, bPos) {
+  let len = 0;
+  while (aPos + len < a.length && bPos + len < b.length && a[aPos + len] === b[bPos + len]) {
+    len++;
+  }
+  return len;
+}
+
+// COPY/LITERAL op stream: copies from the old image, literals for the rest
+function diff(oldImage, newImage) {
+  const table = new Int32Array(1 << HASH_BITS).fill(-1);
+  for (let i = 0; i + HASH_BYTES <= oldImage.length; i++) {
+    table[hashAt(oldImage, i)] = i;
+  }
+
+  const ops = [];
+  let literalStart = 0;
+  let sourcePos = 0;
+  let pos = 0;
+
+  const flushLiteral = (end) => {
+    if (end > literalStart) {
+      ops.push(OP_LITERAL);
+      writeVarint(ops, end - literalStart);
+      for (let i = literalStart; i < end; i++) ops.push(newImage[i]);
+    }
+  };
+
+  while (pos < newImage.length) {
+    // Prefer continuing where the last copy ended, as unchanged code does
+    let bestPos = sourcePos;
+    let bestLen = sourcePos < oldImage.length ? matchLength(oldImage, sourcePos, newImage, pos) : 0;
+    if (bestLen < MIN_COPY && pos + HASH_BYTES <= newImage.length) {
+      const candidate = table[hashAt(newImage, pos)];
+      if (candidate >= 0) {
+        const len = matchLength(oldImage, candidate, newImage, pos);
+        if (len > bestLen) {
+          bestPos = candidate;
+          bestLen = len;
+        }
+      }
+    }
+
+    if (bestLen >= MIN_COPY) {
+      flushLiteral(pos);
+      ops.push(OP_COPY);
+      writeVarint(ops, bestLen);
+      writeVarint(ops, zigzag(bestPos - sourcePos));
+      sourcePos = bestPos + bestLen;
+      pos += bestLen;
+      literalStart = pos;
+    } else {
+      pos++;
+    }
+  }
+  flushLiteral(newImage.length);
+  ops.push(OP_END);
+  return Buffer.from(ops);
+}
+
+// LZSS with a 4 KiB window: a flag byte per eight items (LSB first, 1 =
+// literal), back-references are 12-bit distance - 1 and 4-bit length - 3
+function compress(input) {
+  const out = [];
+  const head = new Map();
+  const prev = new Int32Array(input.length).fill(-1);
+  let flagIndex = -1;
+  let flagBit = 8;
+
+  const beginItem = () => {
+    if (flagBit === 8) {
+      flagIndex = out.length;
+      out.push(0);
+      flagBit = 0;
+    }
+  };
+  const insert = (i) => {
+    if (i + MIN_MATCH > input.length) return;
+    const key = input[i] | input[i + 1] << 8 | input[i + 2] << 16;
+    prev[i] = head.has(key) ? head.get(key) : -1;
+    head.set(key, i);
+  };
+
+  let pos = 0;
+  while (pos < input.length) {
+    let bestLen = 0;
+    let bestDist = 0;
+    if (pos + MIN_MATCH <= input.length) {
+      const key = input[pos] | input[pos + 1] << 8 | input[pos + 2] << 16;
+      let candidate = head.has(key) ? head.get(key) : -1;
+      for (let chain = 0; candidate >= 0 && pos - candidate <= WINDOW_SIZE && chain < MAX_CHAIN; chain++) {
+        let len = 0;
+        while (len < MAX_MATCH && pos + len < input.length && input[candidate + len] === input[pos + len]) {
+          len++;
+        }
+        if (len > bestLen) {
+          bestLen = len;
+          bestDist = pos - candidate;
+          if (len === MAX_MATCH) break;
+        }
+        candidate = prev[candidate];
+      }
+    }
+
+    beginItem();
+    if (bestLen >= MIN_MATCH) {
+      const dist = bestDist - 1;
+      out.push(dist & 0xff, ((dist >> 4) & 0xf0) | (bestLen - MIN_MATCH));
+      for (let i = 0; i < bestLen; i++) insert(pos + i);
+      pos += bestLen;
+    } else {
+      out[flagIndex] |= 1 << flagBit;
+      out.push(input[pos]);
+      insert(pos);
+      pos++;
+    }
+    flagBit++;
+  }
+  return Buffer.from(out);
+}
+
+function sha256(buf) {
+  return crypto.createHash('sha256').update(buf).digest();
+}
+
+function main() {
+  const [oldPath, newPath, outPath] = process.argv.slice(2);
+  if (!outPath) {
+    console.error('Usage: node make-delta.js <old.bin> <new.bin> <out.patch>');
+    process.exit(1);
+  }
+
+  const oldImage = fs.readFileSync(oldPath);
+  const newImage = fs.readFileSync(newPath);
+
+  const ops = diff(oldImage, newImage);
+  const compressed = compress(ops);
+  const useLzss = compressed.length < ops.length;
+
+  const header = Buffer.alloc(48);
+  header.write(MAGIC, 0, 'ascii');
+  header[4] = FORMAT_VERSION;
+  header[5] = useLzss ? FLAG_LZSS : 0;
+  header.writeUInt32LE(oldImage.length, 8);
+  header.writeUInt32LE(newImage.length, 12);
+  sha256(oldImage).copy(header, 16);
+
+  const patch = Buffer.concat([header, useLzss ? compressed : ops]);
+  fs.writeFileSync(outPath, patch);
+
+  const saved = (100 - patch.length * 100 / newImage.length).toFixed(1);
+  console.log(`Patch: ${patch.length} bytes for a ${newImage.length} byte image (${saved}% saved)`);
+  console.log(`Target SHA-256: ${sha256(newImage).toString('hex')}`);
+}
+
+main();
@@ -0,0 +1,139 @@
+'use strict';
+
+// Local stand-in for DPS and IoT Hub that authenticates devices by TLS client
+// certificate, for trying the ESP32 sketch's X.509 mode (AZURE_AUTH_X509)
+// without a cloud enrollment. It answers the three requests the device makes:
+// DPS register, DPS operation status and hub telemetry.
+//
+// Setup (self-signed device certificate; its CN is the device id):
+//   openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+//     -keyout device.key -out device.pem -days 365 -subj "/CN=<device id>"
+//   openssl req -x509 -newkey rsa:2048 -nodes -keyout server.key -out server.pem \
+//     -days 365 -subj "/CN=<this host>"
+//
+// Usage: node x509-standin.js [port]   (the device connects on 443)
+//   HOST    name returned as the assigned hub (default: os.hostname())
+//   CA      certificate(s) trusted for clients (default: device.pem)
+//   CERT    server certificate (default: server.pem)
+//   KEY     server key (default: server.key)
+//
+// On the device set AZURE_DPS_FQDN_ENDPOINT to HOST, TLS_VERIFY_MODE to
+// TLS_VERIFY_NONE (server.pem is not in the Azure root bundle) and seed NVS
+// with AZURE_X509_CERT_PEM / AZURE_X509_KEY_PEM from device.pem and device.key.
+
+const crypto = require('crypto');
+const fs = require('fs');
+const https = require('https');
+const os = require('os');
+
+const port = parseInt(process.argv[2] || '443', 10);
+const hubHost = process.env.HOST || os.hostname();
+
+const operations = new Map();
+let messageCount = 0;
+
+function send(res, status, body) {
+  if (body === undefined) {
+    res.writeHead(status);
+    res.end();
+    return;
+  }
+  const json = JSON.stringify(body);
+  res.writeHead(status, { 'Content-Type': 'application/json', 'Content-Length': Buffer.byteLength(json) });
+  res.end(json);
+}
+
+function handle(req, res, body) {
+  const cert = req.socket.getPeerCertificate();
+  const subject = cert && cert.subject ? cert.subject.CN : undefined;
+
+  if (!req.client.authorized || !subject) {
+    console.log(`${req.method} ${req.url} -> 401 (${req.client.authorizationError || 'no client certificate'})`);
+    send(res, 401, { message: 'client certificate required' });
+    return;
+  }
+
+  const path = req.url.split('?')[0];
+  let match;
+
+  // PUT /{idScope}/registrations/{registrationId}/register
+  if ((match = path.match(/^\/[^/]+\/registrations\/([^/]+)\/register$/)) && req.method === 'PUT') {
+    const registrationId = decodeURIComponent(match[1]);
+    if (registrationId !== subject) {
+      console.log(`register ${registrationId} -> 401 (certificate CN is ${subject})`);
+      send(res, 401, { message: 'registration id does not match certificate' });
+      return;
+    }
+    const operationId = crypto.randomUUID();
+    operations.set(operationId, { registrationId, polls: 0 });
+    console.log(`register ${registrationId} -> 202 ${operationId}`);
+    send(res, 202, { operationId, status: 'assigning' });
+    return;
+  }
+
+  // GET /{idScope}/registrations/{registrationId}/operations/{operationId}
+  if ((match = path.match(/^\/[^/]+\/registrations\/[^/]+\/operations\/([^/]+)$/)) && req.method === 'GET') {
+    const operation = operations.get(match[1]);
+    if (!operation) {
+      send(res, 404, { message: 'unknown operation' });
+      return;
+    }
+    // Report "assigning" once so the device's polling path is exercised
+    if (operation.polls++ === 0) {
+      send(res, 200, { operationId: match[1], status: 'assigning' });
+      return;
+    }
+    operations.delete(match[1]);
+    console.log(`assigned ${operation.registrationId} to ${hubHost}`);
+    send(res, 200, {
+      operationId: match[1],
+      status: 'assigned',
+      registrationState: {
+        registrationId: operation.registrationId,
+        assignedHub: hubHost,
+        deviceId: operation.registrationId,
+        status: 'assigned',
+      },
+    });
+    return;
+  }
+
+  // POST /devices/{deviceId}/messages/events
+  if ((match = path.match(/^\/devices\/([^/]+)\/messages\/events$/)) && req.method === 'POST') {
+    const deviceId = decodeURIComponent(match[1]);
+    if (deviceId !== subject) {
+      send(res, 401, { message: 'device id does not match certificate' });
+      return;
+    }
+    if (req.headers.authorization) {
+      console.log(`warning: ${deviceId} sent an Authorization header in X.509 mode`);
+    }
+    messageCount++;
+    console.log(`#${messageCount} ${deviceId}: ${body}`);
+    send(res, 204);
+    return;
+  }
+
+  send(res, 404, { message: 'not found' });
+}
+
+const server = https.createServer({
+  cert: fs.readFileSync(process.env.CERT || 'server.pem'),
+  key: fs.readFileSync(process.env.KEY || 'server.key'),
+  ca: fs.readFileSync(process.env.CA || 'device.pem'),
+  requestCert: true,
+  rejectUnauthorized: false, // answer with a 401 instead of dropping the handshake
+}, (req, res) => {
+  const chunks = [];
+  req.on('data', (chunk) => chunks.push(chunk));
+  req.on('end', () => handle(req, res, Buffer.concat(chunks).toString()));
+});
+
+server.on('secureConnection', (socket) => {
+  const resumed = socket.isSessionReused() ? ' (resumed)' : '';
+  console.log(`TLS ${socket.getProtocol()} ${socket.getCipher().name} from ${socket.remoteAddress}${resumed}`);
+});
+
+server.listen(port, () => {
+  console.log(`X.509 stand-in for DPS and IoT Hub on port ${port}, assigning hub ${hubHost}`);
+});